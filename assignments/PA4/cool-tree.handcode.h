@@ -20,6 +20,7 @@ void dump_Symbol(ostream& stream, int padding, Symbol b);
 void assert_Symbol(Symbol b);
 Symbol copy_Symbol(Symbol b);
 
+class ast_writer;
 class Program_class;
 typedef Program_class *Program;
 class Class__class;
@@ -46,20 +47,28 @@ typedef Cases_class *Cases;
 
 #define Program_EXTRAS                          \
 virtual void semant() = 0;			\
-virtual void dump_with_types(ostream&, int) = 0; 
+virtual void dump_with_types(ostream&, int) = 0; \
+virtual void dump_binary(ostream&) = 0;          \
+virtual void dump_binary(ast_writer&) = 0;       \
+tree_arena *arena;   /* arena holding this tree */ \
+Program_class() { arena = node_arena; }  \
+void release() { arena->release(); }
 
 
 
 #define program_EXTRAS                          \
 void semant();     				\
-void dump_with_types(ostream&, int);            
+void dump_with_types(ostream&, int);            \
+void dump_binary(ostream&);                     \
+void dump_binary(ast_writer&);
 
 #define Class__EXTRAS                   \
 virtual Symbol get_filename() = 0;      \
 virtual Symbol get_name() = 0;          \
 virtual Symbol get_parent_name() = 0;   \
 virtual Features get_features() = 0;    \
-virtual void dump_with_types(ostream&,int) = 0; 
+virtual void dump_with_types(ostream&,int) = 0; \
+virtual void dump_binary(ast_writer&) = 0;
 
 
 #define class__EXTRAS                                 \
@@ -67,17 +76,20 @@ Symbol get_filename() { return filename; }             \
 Symbol get_name() { return name; }               	   \
 Symbol get_parent_name() { return parent; }       	   \
 Features get_features()  { return features; }     	   \
-void dump_with_types(ostream&,int);                    
+void dump_with_types(ostream&,int);                   \
+void dump_binary(ast_writer&);
 
 
 #define Feature_EXTRAS                                        \
 virtual bool is_method() = 0;               				  \
 virtual bool is_attr() = 0;                  				  \
-virtual void dump_with_types(ostream&,int) = 0; 
+virtual void dump_with_types(ostream&,int) = 0;               \
+virtual void dump_binary(ast_writer&) = 0;
 
 
 #define Feature_SHARED_EXTRAS                                       \
-void dump_with_types(ostream&,int);    
+void dump_with_types(ostream&,int);                                 \
+void dump_binary(ast_writer&);
 
 
 #define method_EXTRAS                          		\
@@ -102,24 +114,28 @@ Symbol type_check();
 #define Formal_EXTRAS                              \
 virtual Symbol get_name() = 0;                 	\
 virtual Symbol get_type() = 0;				   	\
-virtual void dump_with_types(ostream&,int) = 0;
+virtual void dump_with_types(ostream&,int) = 0;    \
+virtual void dump_binary(ast_writer&) = 0;
 
 
 #define formal_EXTRAS                           \
 Symbol get_name() { return name; }              \
 Symbol get_type() { return type_decl; }		 	\
-void dump_with_types(ostream&,int);
+void dump_with_types(ostream&,int);             \
+void dump_binary(ast_writer&);
 
 
 #define Case_EXTRAS                             \
 Symbol type_check();							\
-virtual void dump_with_types(ostream& ,int) = 0;
+virtual void dump_with_types(ostream& ,int) = 0; \
+virtual void dump_binary(ast_writer&) = 0;
 
 
 #define branch_EXTRAS                                   \
 Symbol type_check();									\
 Symbol get_type_decl() { return type_decl; }			\
-void dump_with_types(ostream& ,int);
+void dump_with_types(ostream& ,int);                    \
+void dump_binary(ast_writer&);
 
 
 #define Expression_EXTRAS                    \
@@ -127,12 +143,14 @@ Symbol type;                                 \
 Symbol get_type() { return type; }           \
 Expression set_type(Symbol s) { type = s; return this; } \
 virtual void dump_with_types(ostream&,int) = 0;  \
+virtual void dump_binary(ast_writer&) = 0;       \
 void dump_type(ostream&, int);               \
 virtual Symbol type_check() = 0;							\
 Expression_class() { type = (Symbol) NULL; }
 
 #define Expression_SHARED_EXTRAS           \
 Symbol type_check();					  	\
-void dump_with_types(ostream&,int); 
+void dump_with_types(ostream&,int);        \
+void dump_binary(ast_writer&);
 
 #endif
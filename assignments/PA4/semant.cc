@@ -7,6 +7,7 @@
 #include "utilities.h"
 
 #include <queue>
+#include <algorithm>
 #include <set>
 
 
@@ -19,6 +20,10 @@ Class_ current_class;
 
 std::map<Symbol, std::map<Symbol, method_class*>> class_methods;
 std::map<Symbol, std::map<Symbol, attr_class*>> class_attrs;
+// every method and attribute of a class, its own and the ones it
+// inherits (see register_class_and_its_methods)
+std::unordered_map<Symbol, std::unordered_map<Symbol, method_class*>> all_methods;
+std::unordered_map<Symbol, std::unordered_map<Symbol, attr_class*>> all_attrs;
 
 //////////////////////////////////////////////////////////////////////
 //
@@ -298,6 +303,61 @@ bool ClassTable::check_main_class() {
     return true;
 }
 
+//
+// Numbers the classes in preorder of the inheritance tree, once it is
+// known to be a tree, so that is_subclass and get_lca need not walk up
+// parent_map.  A class and its descendants get consecutive numbers, so
+// "a inherits b" is two compares; the least common ancestor is found by
+// binary lifting over the ancestor table in log(depth) steps.
+//
+void ClassTable::number_classes() {
+    std::map<Symbol, std::vector<Symbol>> children;
+    for (auto &p : parent_map) {
+        children[p.second].push_back(p.first);
+    }
+
+    int n = class_map.size();
+    numbered_class.clear();
+    last_descendant.assign(n, 0);
+    std::vector<int> parent(n, 0);
+    std::vector<std::pair<Symbol, int>> stack;  // class, its parent's number
+    stack.push_back(std::make_pair(Object, 0));
+    while (!stack.empty()) {
+        Symbol name = stack.back().first;
+        int number = numbered_class.size();
+        parent[number] = stack.back().second;
+        stack.pop_back();
+        class_number[name] = number;
+        numbered_class.push_back(name);
+        auto &kids = children[name];
+        for (auto it = kids.rbegin(); it != kids.rend(); it++) {
+            stack.push_back(std::make_pair(*it, number));
+        }
+    }
+    // a class's last descendant is the last one numbered in its subtree
+    for (int i = n - 1; i >= 0; i--) {
+        last_descendant[i] = std::max(last_descendant[i], i);
+        if (i > 0) {
+            last_descendant[parent[i]] = std::max(last_descendant[parent[i]], last_descendant[i]);
+        }
+    }
+
+    ancestor.assign(1, parent);
+    for (int k = 1; (1 << k) < n; k++) {
+        std::vector<int> &half = ancestor[k - 1];
+        std::vector<int> up(n);
+        for (int i = 0; i < n; i++) {
+            up[i] = half[half[i]];
+        }
+        ancestor.push_back(up);
+    }
+}
+
+// class a is class b or one of its ancestors
+bool ClassTable::is_ancestor(int a, int b) {
+    return a <= b && b <= last_descendant[a];
+}
+
 bool ClassTable::is_subclass(Symbol type1, Symbol type2) {
     if (type1 == No_type)
         return true;
@@ -308,15 +368,15 @@ bool ClassTable::is_subclass(Symbol type1, Symbol type2) {
     if (type2 == SELF_TYPE)
         type2 = current_class->get_name();
 
-    while (type1 != Object && type1 != type2)
-        type1 = parent_map[type1];
+    auto n1 = class_number.find(type1);
+    auto n2 = class_number.find(type2);
+    if (n1 == class_number.end() || n2 == class_number.end())
+        return type1 == type2;
 
-    return type1 == type2;
+    return is_ancestor(n2->second, n1->second);
 }
 
 Symbol ClassTable::get_lca(Symbol type1, Symbol type2) {
-    std::set<Symbol> ancestors;
-    Symbol lca = Object;
     if(type1 == type2) return type1;
 
     if (type1 == SELF_TYPE)
@@ -325,20 +385,20 @@ Symbol ClassTable::get_lca(Symbol type1, Symbol type2) {
     if (type2 == SELF_TYPE)
         type2 = current_class->get_name();
 
-    while (type1 != Object) {
-        ancestors.insert(type1);
-        type1 = parent_map[type1];
-    }
+    auto n1 = class_number.find(type1);
+    auto n2 = class_number.find(type2);
+    if (n1 == class_number.end() || n2 == class_number.end())
+        return Object;
 
-    while (type2 != Object) {
-        if (ancestors.find(type2) != ancestors.end()) {
-            lca = type2;
-            break;
-        }
-        type2 = parent_map[type2];
+    int a = n1->second, b = n2->second;
+    if (is_ancestor(a, b)) return type1;
+    if (is_ancestor(b, a)) return type2;
+    // climb from a to the highest ancestor that is not above b
+    for (int k = ancestor.size() - 1; k >= 0; k--) {
+        if (!is_ancestor(ancestor[k][a], b))
+            a = ancestor[k][a];
     }
-
-    return lca;
+    return numbered_class[ancestor[0][a]];
 }
 
 /*
@@ -375,23 +435,24 @@ std::map<Symbol, method_class*> get_class_methods(Class_ class_definition) {
     return class_methods;
 }
 
+// the method a class defines or inherits, or nullptr
 method_class* get_class_method(Symbol class_name, Symbol method_name) {
-    std::map<Symbol, method_class*> methods = class_methods[class_name];
-
-    if (methods.find(method_name) == methods.end())
+    auto c = all_methods.find(class_name);
+    if (c == all_methods.end())
         return nullptr;
 
-    return methods[method_name];
+    auto m = c->second.find(method_name);
+    return m == c->second.end() ? nullptr : m->second;
 }
 
-
+// the attribute a class defines or inherits, or nullptr
 attr_class* get_class_attr(Symbol class_name, Symbol attr_name) {
-    std::map<Symbol, attr_class*> attrs = class_attrs[class_name];
-
-    if (attrs.find(attr_name) == attrs.end())
+    auto c = all_attrs.find(class_name);
+    if (c == all_attrs.end())
         return nullptr;
 
-    return attrs[attr_name];
+    auto a = c->second.find(attr_name);
+    return a == c->second.end() ? nullptr : a->second;
 }
 
 std::map<Symbol, attr_class*> get_class_attributes(Class_ class_definition) {
@@ -422,6 +483,13 @@ std::map<Symbol, attr_class*> get_class_attributes(Class_ class_definition) {
 }
 
 
+// an attribute that can be in scope: not self, and of a known type
+static bool is_valid_attr(attr_class* attr_definition) {
+    return attr_definition->get_name() != self &&
+        (attr_definition->get_type() == SELF_TYPE ||
+         class_table->class_map.find(attr_definition->get_type()) != class_table->class_map.end());
+}
+
 void build_attribute_scopes(Class_ current_class) {
     const auto& attrs = class_attrs[current_class->get_name()];
     for(const auto &x : attrs) {
@@ -431,7 +499,7 @@ void build_attribute_scopes(Class_ current_class) {
                 << "'self' cannot be the name of an attribute.\n";
             continue;
         }
-        if(attr_definition->get_type() != SELF_TYPE && class_table->class_map.find(attr_definition->get_type()) == class_table->class_map.end()){
+        if(!is_valid_attr(attr_definition)){
             class_table->semant_error(attr_definition) 
                 << "Class "
                 << attr_definition->get_type()
@@ -440,22 +508,20 @@ void build_attribute_scopes(Class_ current_class) {
                 << " is undefined.\n";
             continue;
         }
+    }
 
+    for(const auto &x : all_attrs[current_class->get_name()]) {
+        if (!is_valid_attr(x.second))
+            continue;
         objects_table->addid(
-            attr_definition->get_name(), 
-            new Symbol(attr_definition->get_type())
+            x.second->get_name(), 
+            new Symbol(x.second->get_type())
         );
     }
-
-    if(current_class->get_name() == Object)
-        return;
-
-    Class_ parent_definition = class_table->class_map[class_table->parent_map[current_class->get_name()]];
-    build_attribute_scopes(parent_definition);
 }
 
-void process_attr(Class_ origin_class, Class_ current_class, attr_class* attr) {
-    if (get_class_attr(current_class->get_name(), attr->get_name()) != nullptr)
+void process_attr(Class_ origin_class, attr_class* attr) {
+    if (get_class_attr(origin_class->get_parent_name(), attr->get_name()) != nullptr)
     {
         class_table->semant_error(origin_class) 
             << "Attribute " 
@@ -463,17 +529,14 @@ void process_attr(Class_ origin_class, Class_ current_class, attr_class* attr) {
             << " is an attribute of an inherited class.\n";
         cerr << "Compilation halted due to static semantic errors." << endl;
     }
+}
 
-    if(current_class->get_name() == Object) {
+// checks a method against the one it overrides, if any
+void process_method(Class_ current_class, method_class* original_method) {
+    if (current_class->get_name() == Object)
         return;
-    }
 
-    Symbol parent_type_name = current_class->get_parent_name();
-    Class_ parent_definition = class_table->class_map[parent_type_name];
-    process_attr(origin_class, parent_definition, attr);
-}
-
-void process_method(Class_ current_class, method_class* original_method, method_class* parent_method) {
+    method_class* parent_method = get_class_method(current_class->get_parent_name(), original_method->get_name());
     if (parent_method == nullptr)
         return;
 
@@ -528,30 +591,36 @@ void process_method(Class_ current_class, method_class* original_method, method_
         original_formal_ix = original_method_args->next(original_formal_ix);
         parent_formal_ix = parent_method_args->next(parent_formal_ix);
     }
-
-    Symbol parent_type_name = class_table->parent_map[current_class->get_name()];
-
-    if (parent_type_name == No_type)
-        return;
-
-    Class_ parent_class_definition = class_table->class_map[parent_type_name];
-
-    process_method(
-        parent_class_definition, 
-        original_method,
-        get_class_method(
-            parent_type_name, 
-            original_method->get_name()
-        )
-    );
 }
 
+//
+// Collects the methods and attributes each class defines, then, going
+// down the inheritance tree in preorder so that a parent comes before
+// its children, the ones each class has: its parent's, with its own
+// added or overriding them.  Lookups are then a single hash probe.
+//
 void ClassTable::register_class_and_its_methods() {
     for(auto const& x : class_map) {
         Class_ class_definition = x.second;
         class_methods[class_definition->get_name()] = get_class_methods(class_definition);
         class_attrs[class_definition->get_name()] = get_class_attributes(class_definition);
     }
+
+    for (Symbol name : numbered_class) {
+        auto &methods = all_methods[name];
+        auto &attrs = all_attrs[name];
+        if (name != Object) {
+            Symbol parent = parent_map[name];
+            methods = all_methods[parent];
+            attrs = all_attrs[parent];
+        }
+        for (const auto &x : class_methods[name]) {
+            methods[x.first] = x.second;
+        }
+        for (const auto &x : class_attrs[name]) {
+            attrs[x.first] = x.second;
+        }
+    }
 }
 
 /*
@@ -571,12 +640,11 @@ void ClassTable::type_check(Classes classes) {
         build_attribute_scopes(current_class);
         
         for (const auto &x : current_class_methods) {
-            process_method(current_class, x.second, x.second);
+            process_method(current_class, x.second);
         }
 
         for (const auto &x : current_class_attrs) {
-            Class_ parent_definition = class_table->class_map[current_class->get_parent_name()];
-            process_attr(current_class, parent_definition, x.second);
+            process_attr(current_class, x.second);
         }
 
         for (const auto &x : current_class_attrs) {
@@ -887,17 +955,7 @@ Symbol dispatch_class::type_check() {
         return Object;
     }
 
-    auto t = expr_type;
-    method_class* method = nullptr;
-    while (t != No_class) {
-        auto methods = class_methods[t];
-        if (methods.find(name) != methods.end()) {
-            method = methods[name];
-            break;
-        }
-        t = class_table->class_map[t]->get_parent_name();
-    }
-
+    method_class* method = get_class_method(expr_type, name);
     if (method == nullptr) {
         class_table->semant_error(this) 
             << "Dispatch to undefined method " 
@@ -976,7 +1034,8 @@ Symbol static_dispatch_class::type_check() {
         return Object;
     }
 
-    if (class_methods[type_name].find(name) == class_methods[type_name].end()) {
+    method_class* method = get_class_method(type_name, name);
+    if (method == nullptr) {
         class_table->semant_error(this) 
             << "Static dispatch to undefined method " 
             << name 
@@ -985,8 +1044,6 @@ Symbol static_dispatch_class::type_check() {
         return Object;
     }
 
-    method_class* method = class_methods[type_name][name];
-
     if (actual->len() != method->get_formals()->len()) {
         class_table->semant_error(this) 
             << "Method " 
@@ -1221,6 +1278,7 @@ void program_class::semant()
         cerr << "Compilation halted due to static semantic errors." << endl;
         exit(1);
     }
+    class_table->number_classes();
 
     objects_table = new SymbolTable<Symbol, Symbol>();
     class_table->check_main_class();
@@ -9,6 +9,8 @@
 #include "list.h"
 
 #include <map>
+#include <unordered_map>
+#include <vector>
 
 #define TRUE 1
 #define FALSE 0
@@ -31,6 +33,7 @@ private:
 public:
   void install_custom_classes(Classes);
   void get_parent_classes_and_check_inheritance();
+  void number_classes();
   bool check_main_class();
   bool is_subclass(Symbol, Symbol);
   void register_class_and_its_methods();
@@ -44,6 +47,17 @@ public:
   ostream& semant_error(tree_node *t);
   std::map<Symbol, Class_> class_map;
   std::map<Symbol, Symbol> parent_map;
+
+private:
+  // The inheritance tree numbered in preorder by number_classes: the
+  // descendants of class n are the classes n..last_descendant[n], and
+  // ancestor[k][n] is the ancestor 2^k levels above n (Object above
+  // Object).
+  std::unordered_map<Symbol, int> class_number;
+  std::vector<Symbol> numbered_class;
+  std::vector<int> last_descendant;
+  std::vector<std::vector<int>> ancestor;
+  bool is_ancestor(int, int);
 };
 
 
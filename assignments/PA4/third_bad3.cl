@@ -0,0 +1,15 @@
+class Main {
+    main() : Int {
+        0
+    };
+};
+
+(* attribute of an undefined type *)
+class A {
+    y : Undefined;
+};
+
+(* redefine an inherited attribute whose type is undefined *)
+class B inherits A {
+    y : Int;
+};
@@ -13,11 +13,123 @@
 //
 ///////////////////////////////////////////////////////////////////////////
 
+#include <stdlib.h>
 #include "tree.h"
 
 /* line number to assign to the current node being constructed */
 int node_lineno = 1;
 
+/* the arena new tree nodes are allocated from */
+static tree_arena default_arena;
+tree_arena *node_arena = &default_arena;
+
+#define ARENA_BLOCK_SIZE  (64 * 1024)
+#define ARENA_ALIGN       (sizeof(double) > sizeof(void *) ? sizeof(double) : sizeof(void *))
+
+///////////////////////////////////////////////////////////////////////////
+//
+// tree_arena::tree_arena
+//
+// an empty arena; the first block is obtained on the first allocation
+//
+///////////////////////////////////////////////////////////////////////////
+tree_arena::tree_arena()
+{
+    blocks = NULL;
+    next = limit = NULL;
+    used = reserved = 0;
+    nodes = list_cells = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////
+//
+// tree_arena::new_block
+//
+// start a new block large enough for an allocation of size bytes
+//
+///////////////////////////////////////////////////////////////////////////
+void tree_arena::new_block(size_t size)
+{
+    size_t header = (sizeof(block) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    size_t bytes = header + size;
+    if (bytes < ARENA_BLOCK_SIZE)
+	bytes = ARENA_BLOCK_SIZE;
+
+    block *b = (block *) malloc(bytes);
+    if (b == NULL) {
+	cerr << "error: out of memory for the abstract syntax tree\n";
+	exit(1);
+    }
+    b->next = blocks;
+    blocks = b;
+    next = (char *) b + header;
+    limit = (char *) b + bytes;
+    reserved += bytes;
+}
+
+///////////////////////////////////////////////////////////////////////////
+//
+// tree_arena::allocate
+//
+///////////////////////////////////////////////////////////////////////////
+void *tree_arena::allocate(size_t size, int is_list)
+{
+    nodes++;
+    if (is_list)
+	list_cells++;
+    return allocate_array(size);
+}
+
+///////////////////////////////////////////////////////////////////////////
+//
+// tree_arena::allocate_array
+//
+// storage that lives as long as the nodes but is not counted as a node
+//
+///////////////////////////////////////////////////////////////////////////
+void *tree_arena::allocate_array(size_t size)
+{
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    if (size > (size_t) (limit - next))
+	new_block(size);
+
+    void *p = next;
+    next += size;
+    used += size;
+    return p;
+}
+
+///////////////////////////////////////////////////////////////////////////
+//
+// tree_arena::release
+//
+// free every node in the arena at once; destructors are not run
+//
+///////////////////////////////////////////////////////////////////////////
+void tree_arena::release()
+{
+    while (blocks) {
+	block *b = blocks;
+	blocks = b->next;
+	free(b);
+    }
+    next = limit = NULL;
+    used = reserved = 0;
+    nodes = list_cells = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////
+//
+// tree_arena::dump_stats
+//
+///////////////////////////////////////////////////////////////////////////
+void tree_arena::dump_stats(ostream& stream)
+{
+    stream << "ast arena: " << nodes << " nodes (" << list_cells
+	   << " list cells), " << used << " bytes used, "
+	   << reserved << " bytes reserved\n";
+}
+
 ///////////////////////////////////////////////////////////////////////////
 //
 // tree_node::tree_node
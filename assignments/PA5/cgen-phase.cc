@@ -10,8 +10,11 @@ extern char *out_filename;    // name of output assembly
 extern Program ast_root;             // root of the abstract syntax tree
 FILE *ast_file = stdin;       // we read the AST from standard input
 extern int ast_yyparse(void); // entry point to the AST parser
+extern int binary_ast(FILE *);          // is the AST in binary?
+extern Program read_binary_ast(FILE *); // entry point to the binary AST reader
 
 int cool_yydebug;     // not used, but needed to link with handle_flags
+extern int ast_stats; // report AST arena usage
 char *curr_filename;
 
 void handle_flags(int argc, char *argv[]);
@@ -34,7 +37,10 @@ int main(int argc, char *argv[]) {
   // Don't touch the output file until we know that earlier phases of the
   // compiler have succeeded.
   //
-  ast_yyparse();
+  if (binary_ast(ast_file))
+      ast_root = read_binary_ast(ast_file);
+  else
+      ast_yyparse();
 
   if (out_filename) {
       ofstream s(out_filename);
@@ -46,5 +52,7 @@ int main(int argc, char *argv[]) {
   } else {
       ast_root->cgen(cout);
   }
+  if (ast_stats) ast_root->arena->dump_stats(cerr);
+  ast_root->release();
 }
 
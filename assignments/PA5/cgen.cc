@@ -1,9 +1,23 @@
 #include "cgen.h"
 #include "cgen_gc.h"
+#include <limits.h>
+#include <ctype.h>
+#include <atomic>
+#include <thread>
 
 extern void emit_string_constant(ostream& str, char *s);
 extern int cgen_debug;
-static EnvTable* envTable = nullptr;
+extern int cgen_optimize;
+extern int cgen_jobs;
+extern int cgen_inline_size;
+extern int cgen_intcache_min;   // the range of the Int cache (-k)
+extern int cgen_intcache_max;
+extern bool disable_reg_alloc;
+extern int node_lineno;       // line number given to new tree nodes
+// the unit being coded on this thread, and its environment and registers
+static thread_local CgenUnit* curr_unit = nullptr;
+static thread_local EnvTable* envTable = nullptr;
+static thread_local RegAllocator* regAlloc = nullptr;
 static CgenClassTable *codegen_classtable = nullptr;
 //
 // Three symbols from the semantic analyzer (semant.cc) are used.
@@ -82,10 +96,20 @@ static void initialize_constants(void)
   val         = idtable.add_string("_val");
 }
 
+//
+// An omitted initializer is a no_expr.  Its type is NULL when the tree was
+// read back from semant's output, and No_type when semant ran in the same
+// process (see coolc.cc).
+//
+static bool is_no_expr(Expression e)
+{
+  return e->get_type() == NULL || e->get_type() == No_type;
+}
+
 static char *gc_init_names[] =
-  { "_NoGC_Init", "_GenGC_Init", "_ScnGC_Init" };
+  { "_NoGC_Init", "_GenGC_Init", "_SncGC_Init" };
 static char *gc_collect_names[] =
-  { "_NoGC_Collect", "_GenGC_Collect", "_ScnGC_Collect" };
+  { "_NoGC_Collect", "_GenGC_Collect", "_SncGC_Collect" };
 
 
 //  BoolConst is a class that implements code generation for operations
@@ -112,7 +136,7 @@ void program_class::cgen(ostream &os)
   os << "# start of generated code\n";
 
   initialize_constants();
-  envTable = new EnvTable();
+  if (cgen_optimize) fold();
   codegen_classtable = new CgenClassTable(classes,os);
 
   os << "\n# end of generated code\n";
@@ -202,17 +226,65 @@ static void emit_sub(char *dest, char *src1, char *src2, ostream& s)
 static void emit_sll(char *dest, char *src1, int num, ostream& s)
 { s << SLL << dest << " " << src1 << " " << num << endl; }
 
+static void emit_slt(char *dest, char *src1, char *src2, ostream& s)
+{ s << SLT << dest << " " << src1 << " " << src2 << endl; }
+
+static void emit_sle(char *dest, char *src1, char *src2, ostream& s)
+{ s << SLE << dest << " " << src1 << " " << src2 << endl; }
+
+static void emit_seq(char *dest, char *src1, char *src2, ostream& s)
+{ s << SEQ << dest << " " << src1 << " " << src2 << endl; }
+
+//
+// Ends the line of a call.  The calls of a routine are noted in order,
+// with their stack maps, for the IR passes (see emit_routine).
+//
+static void emit_call_end(int map, ostream& s)
+{
+  if (curr_unit) {
+    curr_unit->routine.call_maps.push_back(map);
+  }
+  s << endl;
+}
+
+//
+// Ends the line of a call that may collect garbage.  With a collector,
+// the stack map of the frame is recorded and named in a comment on the
+// call, which place_unit replaces with the return label the collector
+// finds the map by (see code_stack_maps).
+//
+static void emit_stack_map(ostream& s)
+{
+  int id = -1;
+  if (cgen_Memmgr != GC_NOGC) {
+    StackMap map;
+    envTable->stack_map(map);
+    map.saves = 0;
+    const std::vector<char*> &regs = regAlloc->used_regs();
+    for (int i = 0; i < (int) regs.size(); i++) {
+      map.saves |= (i + 1) << (4 * (atoi(regs[i] + 2) - 1));
+    }
+    id = codegen_classtable->add_stack_map(map);
+    s << "\t# stackmap " << id;
+  }
+  emit_call_end(id, s);
+}
+
 static void emit_jalr(char *dest, ostream& s)
-{ s << JALR << "\t" << dest << endl; }
+{ s << JALR << "\t" << dest; emit_stack_map(s); }
 
 static void emit_jal(char *address,ostream &s)
-{ s << JAL << address << endl; }
+{ s << JAL << address; emit_call_end(-1, s); }
+
+// a call into a routine that may collect garbage
+static void emit_gc_jal(char *address, ostream &s)
+{ s << JAL << address; emit_stack_map(s); }
 
 static void emit_return(ostream& s)
 { s << RET << endl; }
 
 static void emit_gc_assign(ostream& s)
-{ s << JAL << "_GenGC_Assign" << endl; }
+{ s << JAL << "_GenGC_Assign"; emit_stack_map(s); }
 
 static void emit_disptable_ref(Symbol sym, ostream& s)
 {  s << sym << DISPTAB_SUFFIX; }
@@ -270,6 +342,13 @@ static void emit_blt(char *src1, char *src2, int label, ostream &s)
   s << endl;
 }
 
+static void emit_bge(char *src1, char *src2, int label, ostream &s)
+{
+  s << BGE << src1 << " " << src2 << " ";
+  emit_label_ref(label,s);
+  s << endl;
+}
+
 static void emit_blti(char *src1, int imm, int label, ostream &s)
 {
   s << BLT << src1 << " " << imm << " ";
@@ -300,6 +379,38 @@ static void emit_push(char *reg, ostream& str)
   emit_addiu(SP,SP,-4,str);
 }
 
+//
+// A slot of the frame for a local or a temporary.  Without -O the slot
+// is pushed when the code takes it and popped when it is given back.  In
+// a fixed frame (-O) emit_start_frame has reserved every slot, so a slot
+// is stored and loaded at its $fp offset and $sp never moves.
+//
+static void emit_push_slot(char *reg, ostream &s)
+{
+  if (envTable->fixed_frame()) {
+    emit_store(reg, envTable->next_slot(), FP, s);
+  } else {
+    emit_push(reg, s);
+  }
+}
+
+// load the slot just given back (by pop_temp or exitscope)
+static void emit_load_slot(char *reg, ostream &s)
+{
+  if (envTable->fixed_frame()) {
+    emit_load(reg, envTable->next_slot(), FP, s);
+  } else {
+    emit_load(reg, 1, SP, s);
+  }
+}
+
+static void emit_pop_slot(ostream &s)
+{
+  if (!envTable->fixed_frame()) {
+    emit_addiu(SP, SP, 4, s);
+  }
+}
+
 //
 // Fetch the integer value in an Int object.
 // Emits code to fetch the integer value of the Integer object pointed
@@ -321,7 +432,8 @@ static void emit_test_collector(ostream &s)
   emit_push(ACC, s);
   emit_move(ACC, SP, s); // stack end
   emit_move(A1, ZERO, s); // allocate nothing
-  s << JAL << gc_collect_names[cgen_Memmgr] << endl;
+  s << JAL << gc_collect_names[cgen_Memmgr];
+  emit_call_end(-1, s);
   emit_addiu(SP,SP,4,s);
   emit_load(ACC,0,SP,s);
 }
@@ -329,24 +441,29 @@ static void emit_test_collector(ostream &s)
 static void emit_gc_check(char *source, ostream &s)
 {
   if (source != (char*)A1) emit_move(A1, source, s);
-  s << JAL << "_gc_check" << endl;
+  s << JAL << "_gc_check";
+  emit_call_end(-1, s);
 }
 
-static void emit_start_frame(ostream &s) {
-    emit_addiu(SP, SP, -12, s);
-    emit_store(FP, 3, SP, s);
-    emit_store(SELF, 2, SP, s);
-    emit_store(RA, 1, SP, s);
-    emit_addiu(FP, SP, 4, s);
+//
+// words is the size of a fixed frame's slots (EnvTable::frame_words),
+// reserved below $fp along with the saved $fp, $s0 and $ra.
+//
+static void emit_start_frame(ostream &s, int words = 0) {
+    emit_addiu(SP, SP, -12 - WORD_SIZE * words, s);
+    emit_store(FP, 3 + words, SP, s);
+    emit_store(SELF, 2 + words, SP, s);
+    emit_store(RA, 1 + words, SP, s);
+    emit_addiu(FP, SP, 4 + WORD_SIZE * words, s);
     emit_move(SELF, ACC, s);
 }
 
-static void emit_end_frame(ostream &s) {
+static void emit_end_frame(ostream &s, int words = 0) {
     // emit_move(ACC, SELF, s);
-    emit_load(FP, 3, SP, s);
-    emit_load(SELF, 2, SP, s);
-    emit_load(RA, 1, SP, s);
-    emit_addiu(SP, SP, 12, s);
+    emit_load(FP, 3 + words, SP, s);
+    emit_load(SELF, 2 + words, SP, s);
+    emit_load(RA, 1 + words, SP, s);
+    emit_addiu(SP, SP, 12 + WORD_SIZE * words, s);
 }
 
 static void emit_abort(int lebal, int lineno, ostream &s) {
@@ -363,14 +480,368 @@ static void emit_gc_update(char *src, int offset, ostream &s) {
    }
 }
 
-static void emit_load_t1_t2(ostream &s, Expression e1, Expression e2) {
+//
+// e1 in T1, e2 in ACC and T2.  e1 is kept in temp_reg while e2 is coded,
+// or pushed if there is no register for it.
+//
+static void emit_load_t1_t2(ostream &s, Expression e1, Expression e2, char *temp_reg = nullptr) {
     e1->code(s);
-    emit_push(ACC, s);
+    if (temp_reg) {
+        emit_move(temp_reg, ACC, s);
+        envTable->enterscope();
+        envTable->hold_reg(temp_reg, false);
+        e2->code(s);
+        envTable->exitscope();
+        emit_move(T1, temp_reg, s);
+        emit_move(T2, ACC, s);
+        return;
+    }
+    emit_push_slot(ACC, s);
+    envTable->push_temp();
     e2->code(s);
+    envTable->pop_temp();
 
-    emit_load(T1, 1, SP, s);
+    emit_load_slot(T1, s);
     emit_move(T2, ACC, s);
-    emit_addiu(SP, SP, 4, s);
+    emit_pop_slot(s);
+}
+
+//
+// Unboxed Int and Bool values (-O).
+//
+// With cgen_optimize set, an expression of type Int or Bool can be coded
+// with code_unboxed(), which leaves the raw value (0 or 1 for a Bool) in
+// ACC instead of a pointer to an object.  Arithmetic and comparisons
+// work on raw values, and Int and Bool let variables hold raw values in
+// their stack slots.  code() still returns an object, so a value is
+// boxed only where it escapes the method: as an argument, an attribute,
+// a return value, a case scrutinee or an operand of = on Objects.
+//
+static bool is_unboxed_type(Symbol type)
+{
+  return cgen_optimize && (type == Int || type == Bool);
+}
+
+// e1 raw in T1, e2 raw in ACC
+static void emit_unboxed_t1_acc(ostream &s, Expression e1, Expression e2, char *temp_reg) {
+    e1->code_unboxed(s);
+    if (temp_reg) {
+        emit_move(temp_reg, ACC, s);
+        envTable->enterscope();
+        envTable->hold_reg(temp_reg, true);
+        e2->code_unboxed(s);
+        envTable->exitscope();
+        emit_move(T1, temp_reg, s);
+        return;
+    }
+    emit_push_slot(ACC, s);
+    envTable->push_temp(1, EnvTable::RAW_SLOT);
+    e2->code_unboxed(s);
+    envTable->pop_temp();
+    emit_load_slot(T1, s);
+    emit_pop_slot(s);
+}
+
+//
+// Inline allocation (-O).
+//
+// A copy of an object whose size is known is allocated by bumping $gp
+// against the limit in $s7, as _quick_copy in the runtime does, and its
+// words are copied unrolled.  Only when the work area is full is
+// Object.copy called, which runs the collector.  In test mode (-t) the
+// collector runs on every Object.copy, so the call is always made.  With
+// a collector the stack maps are registered, and the runtime then
+// allocates objects without an eyecatcher (_MemMgr_EYECATCH), so this
+// does too.
+//
+#define INLINE_ALLOC_WORDS 16   // larger objects are copied by the runtime
+
+static bool inline_alloc(int words)
+{
+  return cgen_optimize && cgen_Memmgr_Test != GC_TEST &&
+         words <= INLINE_ALLOC_WORDS;
+}
+
+// copy of the object of `words` words in T2 -> ACC.  Only the first
+// `copied` words are copied on the fast path; the caller stores the
+// rest.  keep, if given, is a register with a raw value that is saved
+// around the slow path.
+static void emit_alloc_copy(int words, int copied, ostream &s,
+                            char *keep = nullptr) {
+    int slow = codegen_classtable->get_labelid_and_add();
+    int done = codegen_classtable->get_labelid_and_add();
+    bool eyecatch = cgen_Memmgr == GC_NOGC;
+    int bytes = WORD_SIZE * (words + (eyecatch ? 1 : 0));
+    emit_addiu(GP, GP, bytes, s);
+    emit_bge(GP, LIMIT, slow, s);
+    emit_addiu(ACC, GP, -WORD_SIZE * words, s);
+    if (eyecatch) {
+        emit_load_imm(T1, -1, s);
+        emit_store(T1, -1, ACC, s);
+    }
+    for (int i = 0; i < copied; i++) {
+        emit_load(T1, i, T2, s);
+        emit_store(T1, i, ACC, s);
+    }
+    emit_branch(done, s);
+    emit_label_def(slow, s);
+    emit_addiu(GP, GP, -bytes, s);
+    emit_move(ACC, T2, s);
+    if (keep) {
+        emit_push_slot(keep, s);
+        envTable->push_temp(1, EnvTable::RAW_SLOT);
+    }
+    emit_gc_jal("Object.copy", s);
+    if (keep) {
+        envTable->pop_temp();
+        emit_load_slot(keep, s);
+        emit_pop_slot(s);
+    }
+    emit_label_def(done, s);
+}
+
+// raw int in ACC -> Int object in ACC, from the cache (code_int_cache)
+// when the value is in its range, or else a new one
+static void emit_box_int(ostream &s) {
+    int alloc = codegen_classtable->get_labelid_and_add();
+    int done = codegen_classtable->get_labelid_and_add();
+    emit_blti(ACC, cgen_intcache_min, alloc, s);
+    emit_bgti(ACC, cgen_intcache_max, alloc, s);
+    emit_addiu(T1, ACC, -cgen_intcache_min, s);
+    emit_sll(T2, T1, 4, s);            // 20 bytes an object:
+    emit_sll(T1, T1, 2, s);            // 16x + 4x
+    emit_addu(T1, T1, T2, s);
+    emit_load_address(ACC, INTCACHE, s);
+    emit_addu(ACC, ACC, T1, s);
+    emit_branch(done, s);
+    emit_label_def(alloc, s);
+    if (inline_alloc(DEFAULT_OBJFIELDS + INT_SLOTS)) {
+        emit_move(T3, ACC, s);
+        emit_load_address(T2, "Int" PROTOBJ_SUFFIX, s);
+        emit_alloc_copy(DEFAULT_OBJFIELDS + INT_SLOTS, DEFAULT_OBJFIELDS, s, T3);
+        emit_store_int(T3, ACC, s);
+    } else {
+        emit_push_slot(ACC, s);
+        envTable->push_temp(1, EnvTable::RAW_SLOT);
+        emit_load_address(ACC, "Int" PROTOBJ_SUFFIX, s);
+        emit_gc_jal("Object.copy", s);
+        envTable->pop_temp();
+        emit_load_slot(T1, s);
+        emit_pop_slot(s);
+        emit_store_int(T1, ACC, s);
+    }
+    emit_label_def(done, s);
+}
+
+// raw bool in ACC -> one of the two Bool constants in ACC
+static void emit_box_bool(ostream &s) {
+    int lebalid = codegen_classtable->get_labelid_and_add();
+    emit_move(T1, ACC, s);
+    emit_load_bool(ACC, truebool, s);
+    emit_bne(T1, ZERO, lebalid, s);
+    emit_load_bool(ACC, falsebool, s);
+    emit_label_def(lebalid, s);
+}
+
+static void emit_box(Symbol type, ostream &s) {
+    if (type == Int) {
+        emit_box_int(s);
+    } else {
+        emit_box_bool(s);
+    }
+}
+
+//
+// Register allocation (see RegAllocator in cgen.h).
+//
+static bool reg_alloc_enabled()
+{
+  return cgen_optimize && !disable_reg_alloc;
+}
+
+static void emit_load_local(const EnvTable::Binding *local, ostream &s) {
+    if (local->reg) {
+        emit_move(ACC, local->reg, s);
+    } else {
+        emit_load(ACC, local->offset, FP, s);
+    }
+}
+
+static void emit_store_local(const EnvTable::Binding *local, ostream &s) {
+    if (local->reg) {
+        emit_move(local->reg, ACC, s);
+    } else {
+        emit_store(ACC, local->offset, FP, s);
+    }
+}
+
+//
+// The registers a frame uses are saved in the first slots below $fp,
+// right after emit_start_frame, and restored before emit_end_frame.
+// Registers are only allocated under -O, where the frame is fixed, so
+// the slots are taken before the routine's code (reserve_save_slots) and
+// emit_start_frame reserves them with the rest.
+//
+static void reserve_save_slots() {
+    envTable->push_temp(regAlloc->used_regs().size(), EnvTable::SAVED_SLOT);
+}
+
+static void emit_save_regs(ostream &s) {
+    const std::vector<char*> &regs = regAlloc->used_regs();
+    for (int i = 0; i < (int) regs.size(); i++) {
+        emit_store(regs[i], -1 - i, FP, s);
+    }
+}
+
+static void emit_restore_regs(ostream &s) {
+    const std::vector<char*> &regs = regAlloc->used_regs();
+    for (int i = 0; i < (int) regs.size(); i++) {
+        emit_load(regs[i], -1 - i, FP, s);
+    }
+}
+
+//
+// The size of a fixed frame is known only once its routine is coded.
+// The stack maps of the routine's calls then get it, and the arguments
+// pushed below the frame become slots of their own.  The maps of a frame
+// that grows as it goes (no -O) are right as they are.
+//
+static void place_frame(CgenUnit &u, int first_map, int words) {
+    if (!envTable->fixed_frame()) {
+        return;
+    }
+    for (int i = first_map; i < (int) u.stack_maps.size(); i++) {
+        StackMap &map = u.stack_maps[i];
+        for (int j = 0; j < map.pushed; j++) {
+            map.slots.push_back(-1 - words - j);
+        }
+        map.depth = words + map.pushed;
+        map.pushed = 0;
+    }
+}
+
+//
+// Leaf routines (-O).
+//
+// A routine that makes no calls, which also means it does not allocate,
+// needs no frame pointer: no stack map describes its frame and $ra stays
+// put.  Its code is coded as usual, with self in $s0 and its formals and
+// slots at $fp offsets, and then, if it is a leaf, rewritten: self is
+// kept in a temporary register the code does not use, so $s0 need not be
+// saved, and the $fp offsets become offsets from $sp, which a fixed frame
+// never moves.  $sp is where a full frame would put it, so the words of
+// the saved $fp, $s0 and $ra are simply left unused; with no slots the
+// frame is empty.
+//
+static char *leaf_self_regs[] = { "$t4", "$t5", "$t6", "$t7", "$t8", "$t9" };
+
+static int leaf_frame_bytes(int words) {
+    return words ? 12 + WORD_SIZE * words : 0;
+}
+
+// the register self is kept in if code is a leaf's, or NULL
+static char *leaf_self_reg(const std::string &code) {
+    std::istringstream in(code);
+    std::string line;
+    while (std::getline(in, line)) {
+        IRInstr instr = IRInstr::parse(line);
+        std::set<std::string> uses, defs;
+        instr.uses(uses);
+        instr.defs(defs);
+        switch (instr.kind) {
+        case IR_CALL:
+        case IR_RETURN:
+            return nullptr;
+        case IR_OPAQUE:
+            if (line.find('$') != std::string::npos) {
+                return nullptr;
+            }
+            break;
+        case IR_LOAD:
+            if (instr.src1 == FP) {   // a formal or a slot
+                uses.erase(FP);
+            }
+            break;
+        case IR_STORE:
+            if (instr.src2 == FP && instr.src1 != FP) {
+                uses.erase(FP);
+            }
+            break;
+        default:
+            break;
+        }
+        for (const char *reg : { FP, SP, RA }) {
+            if (uses.count(reg) || defs.count(reg)) {
+                return nullptr;
+            }
+        }
+        if (defs.count(SELF)) {
+            return nullptr;
+        }
+    }
+    for (char *reg : leaf_self_regs) {
+        if (code.find(reg) == std::string::npos) {
+            return reg;
+        }
+    }
+    return nullptr;
+}
+
+static void emit_leaf_code(const std::string &code, int words, char *self, ostream &s) {
+    // a full frame's $fp is 8 bytes below $sp on entry
+    int shift = leaf_frame_bytes(words) - 2 * WORD_SIZE;
+    std::istringstream in(code);
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t pos;
+        while ((pos = line.find(SELF)) != std::string::npos) {
+            line.replace(pos, strlen(SELF), self);
+        }
+        if ((pos = line.find("(" FP ")")) != std::string::npos) {
+            size_t start = line.find_last_of(" \t", pos) + 1;
+            int offset = atoi(line.substr(start, pos - start).c_str()) + shift;
+            line.replace(start, pos + strlen("(" FP ")") - start,
+                         std::to_string(offset) + "(" SP ")");
+        }
+        s << line << endl;
+    }
+}
+
+//
+// The frame of a routine around its code: code saves and restores the
+// registers the routine uses, words are its fixed frame's slots.
+//
+static void emit_frame(const std::string &code, int words, ostream &s) {
+    char *self = cgen_optimize ? leaf_self_reg(code) : nullptr;
+    if (!self) {
+        emit_start_frame(s, words);
+        s << code;
+        emit_end_frame(s, words);
+        return;
+    }
+    int bytes = leaf_frame_bytes(words);
+    if (bytes) {
+        emit_addiu(SP, SP, -bytes, s);
+    }
+    emit_move(self, ACC, s);
+    emit_leaf_code(code, words, self, s);
+    if (bytes) {
+        emit_addiu(SP, SP, bytes, s);
+    }
+}
+
+//
+// Each routine is coded into a buffer first.  Under -O the buffer goes
+// through the IR passes (see cgen_ir.cc) on its way to the unit's text,
+// with what was noted of its calls and jump tables as it was coded.
+//
+static void emit_routine(const std::string &code, CgenUnit &u) {
+    if (cgen_optimize) {
+        optimize_routine(code, u.routine, u.text);
+    } else {
+        u.text << code;
+    }
+    u.routine = IRRoutineInfo();
 }
 
 
@@ -464,6 +935,23 @@ void IntEntry::code_def(ostream &s, int intclasstag)
       s << WORD << str << endl;                           // integer value
 }
 
+//
+// The Int objects for cgen_intcache_min..cgen_intcache_max (-k lo:hi,
+// -128:1023 by default), each with its eyecatcher, one after the other
+// from the label INTCACHE.  Ints are immutable, so emit_box_int can
+// return these instead of allocating.
+//
+static void code_int_cache(ostream &s, int intclasstag)
+{
+  for (int i = cgen_intcache_min; i <= cgen_intcache_max; i++) {
+    s << WORD << "-1" << endl;
+    if (i == cgen_intcache_min) s << INTCACHE << LABEL;
+    s << WORD << intclasstag << endl
+      << WORD << (DEFAULT_OBJFIELDS + INT_SLOTS) << endl
+      << WORD << INTNAME << DISPTAB_SUFFIX << endl
+      << WORD << i << endl;
+  }
+}
 
 //
 // IntTable::code_string_table
@@ -474,6 +962,7 @@ void IntTable::code_string_table(ostream &s, int intclasstag)
 {
   for (List<IntEntry> *l = tbl; l; l = l->tl())
     l->hd()->code_def(s,intclasstag);
+  if (cgen_optimize) code_int_cache(s, intclasstag);
 }
 
 
@@ -592,7 +1081,11 @@ void CgenClassTable::code_select_gc()
   //
   str << GLOBAL << "_MemMgr_INITIALIZER" << endl;
   str << "_MemMgr_INITIALIZER:" << endl;
-  str << WORD << gc_init_names[cgen_Memmgr] << endl;
+  if (cgen_Memmgr != GC_NOGC) {
+    str << WORD << STACKMAPTAB << CLASSINIT_SUFFIX << endl;
+  } else {
+    str << WORD << gc_init_names[cgen_Memmgr] << endl;
+  }
   str << GLOBAL << "_MemMgr_COLLECTOR" << endl;
   str << "_MemMgr_COLLECTOR:" << endl;
   str << WORD << gc_collect_names[cgen_Memmgr] << endl;
@@ -629,7 +1122,8 @@ void CgenClassTable::code_constants()
 }
 
 
-CgenClassTable::CgenClassTable(Classes classes, ostream& s) : nds(NULL) , str(s)
+CgenClassTable::CgenClassTable(Classes classes, ostream& s) : nds(NULL) , str(s),
+   placed_labels_(0), dispatch_cnt_(0), devirtualized_cnt_(0), inlined_cnt_(0)
 {
    stringclasstag = 1;
    intclasstag =    2;
@@ -644,6 +1138,7 @@ CgenClassTable::CgenClassTable(Classes classes, ostream& s) : nds(NULL) , str(s)
    install_name_to_cgen();
    install_classtags();
    install_attrs_and_methods();
+   install_monomorphic_methods();
 
    code();
    exitscope();
@@ -842,7 +1337,7 @@ void CgenClassTable::install_classtags(){
 
     std::function<void(CgenNodeP)> dfs_set_tags = [&](CgenNodeP curr_cgen) {
         curr_cgen->set_classtag(curr_tag);
-        class_tag_map_[curr_tag] = curr_cgen->get_name();
+        class_by_tag_.push_back(curr_cgen);
         Symbol curr_name = curr_cgen->get_name();
         if (curr_name == Str) {
             stringclasstag = curr_tag;
@@ -871,52 +1366,78 @@ void CgenClassTable::install_classtags(){
 }
 
 void CgenClassTable::install_attrs_and_methods(){
-    CgenNodeP curr_cgennode;
-    Features curr_features;
-    for (List<CgenNode> *l = nds; l; l = l->tl()) {
-        curr_cgennode = l->hd();
-        curr_features = curr_cgennode->get_features();
-        Feature curr_feature;
-        Symbol curr_cgen_name = curr_cgennode->get_name();
+    layouts_.resize(class_by_tag_.size());
+    for (CgenNodeP curr_cgennode : class_by_tag_) {
+        ClassLayout &layout = layouts_[curr_cgennode->get_classtag()];
+        Features curr_features = curr_cgennode->get_features();
         for (int i = curr_features->first(); curr_features->more(i); i = curr_features->next(i)) {
-            curr_feature = curr_features->nth(i);
+            Feature curr_feature = curr_features->nth(i);
             if (curr_feature->is_method()) {
-                class_method_map_[curr_cgen_name].push_back(static_cast<method_class*>(curr_feature));
+                layout.own_methods.push_back(static_cast<method_class*>(curr_feature));
             } else {
-                class_attr_map_[curr_cgennode->get_name()].push_back(static_cast<attr_class*>(curr_feature));
+                layout.own_attrs.push_back(static_cast<attr_class*>(curr_feature));
             }
         }
-    }
-   for (List<CgenNode> *l = nds; l; l = l->tl()) {
-        curr_cgennode = l->hd();
+
         Symbol curr_name = curr_cgennode->get_name();
-        CgenNodeP pa = curr_cgennode;
-        std::vector<CgenNodeP> chain;
-        while (true) {
-            chain.push_back(pa);
-            if (pa->get_name() == Object) {
-                break;
+        CgenNodeP parent = curr_cgennode->get_parentnd();
+        if (curr_name == Object) {
+            curr_cgennode->set_chain_depth(1);
+        } else {
+            const ClassLayout &parent_layout = layouts_[parent->get_classtag()];
+            layout.attrs = parent_layout.attrs;
+            layout.attr_offsets = parent_layout.attr_offsets;
+            layout.disptab = parent_layout.disptab;
+            layout.meth_offsets = parent_layout.meth_offsets;
+            layout.no_inits = parent_layout.no_inits;
+            curr_cgennode->set_chain_depth(parent->get_chain_depth() + 1);
+        }
+        for (auto attr : layout.own_attrs) {
+            layout.attr_offsets[attr->get_name()] = ATTR_BASE_OFFSET + layout.attrs.size();
+            layout.attrs.push_back(attr);
+            if (!is_no_expr(attr->get_init())) {
+                layout.no_inits = false;
             }
-            pa = pa->get_parentnd();
         }
-        std::reverse(chain.begin(), chain.end());
-        for (auto parent : chain) {
-            auto methods = class_method_map_[parent->get_name()];
-            for (auto method : methods) {  // 获取其中的method
-                Symbol meth_name = method->get_name();
-
-                if (meth_offset_map_[curr_name].find(meth_name) == meth_offset_map_[curr_name].end()) {
-                    dispatch_tab_map_[curr_name].push_back({parent->get_name(), meth_name});
-                    meth_offset_map_[curr_name][meth_name] = dispatch_tab_map_[curr_name].size() - 1;
-                } else {
-                    auto meth_offset = meth_offset_map_[curr_name][meth_name];
-                    dispatch_tab_map_[curr_name][meth_offset] = {parent->get_name(), meth_name};
-                }
+        for (auto method : layout.own_methods) {  // 获取其中的method
+            Symbol meth_name = method->get_name();
+            auto find_meth = layout.meth_offsets.find(meth_name);
+            if (find_meth == layout.meth_offsets.end()) {
+                layout.meth_offsets[meth_name] = layout.disptab.size();
+                layout.disptab.push_back({curr_name, meth_name});
+            } else {
+                layout.disptab[find_meth->second] = {curr_name, meth_name};
             }
         }
-        curr_cgennode->set_chain_depth(chain.size());
-        parent_chain_map_[curr_name] = std::move(chain);
-   }
+    }
+}
+
+//
+// Class hierarchy analysis.  The classes below a class C have the
+// tags C's tag + 1 .. C's tag + its descendant count (install_classtags
+// numbers the tree depth first).  A method of C is monomorphic when
+// every one of those classes has the same implementation in the
+// method's dispatch table slot as C has, so a dispatch on a receiver
+// of static type C can call that implementation directly.
+//
+void CgenClassTable::install_monomorphic_methods() {
+    for (List<CgenNode> *l = nds; l; l = l->tl()) {
+        CgenNodeP curr_cgennode = l->hd();
+        Symbol curr_name = curr_cgennode->get_name();
+        int first = curr_cgennode->get_classtag() + 1;
+        int last = curr_cgennode->get_classtag() + curr_cgennode->get_descendants_cnt();
+        ClassLayout &layout = layouts_[curr_cgennode->get_classtag()];
+        const auto &distab = layout.disptab;
+        for (size_t offset = 0; offset < distab.size(); offset++) {
+            bool monomorphic = true;
+            for (int tag = first; tag <= last && monomorphic; tag++) {
+                monomorphic = layouts_[tag].disptab[offset].first == distab[offset].first;
+            }
+            if (monomorphic) {
+                layout.monomorphic[distab[offset].second] = distab[offset].first;
+            }
+        }
+    }
 }
 
 
@@ -938,12 +1459,49 @@ void CgenClassTable::code()
   code_object_disptabs();
   if (cgen_debug) cout << "coding object prot" << endl;
   code_protobjs();
+  //
+  // The routines are coded before the global text, so that the stack
+  // maps they make can go in the data segment ahead of the heap.  The
+  // _init routines come first, then the methods, each in class order.
+  //
+  std::vector<CgenUnit> units(2 * list_length(nds));
+  int i = 0;
+  for (int init = 1; init >= 0; init--) {
+    for (List<CgenNode> *l = nds; l; l = l->tl(), i++) {
+      units[i].cls = l->hd();
+      units[i].init = init;
+    }
+  }
+  // A tree list is flattened into the shared tree arena the first time
+  // it is read, which the threads must not do.  The basic classes only
+  // exist from here on, so the lists are flattened here rather than in
+  // program_class::cgen.
+  for (List<CgenNode> *l = nds; l; l = l->tl()) {
+    l->hd()->flatten_lists();
+  }
+  if (cgen_debug) cout << "coding object init methods and methods" << endl;
+  code_units(units);
+  std::ostringstream text;
+  for (auto &u : units) {
+    place_unit(u, text);
+  }
+  if (cgen_Memmgr != GC_NOGC) {
+    if (cgen_debug) cout << "coding stack maps" << endl;
+    code_stack_maps();
+  }
+  if (cgen_debug) cout << "coding case tables" << endl;
+  code_case_tables();
   if (cgen_debug) cout << "coding global text" << endl;
   code_global_text();
-  if (cgen_debug) cout << "coding object init method" << endl;
-  code_object_inits();
-  if (cgen_debug) cout << "coding methods" << endl;
-  code_methods();
+  str << text.str();
+
+  if (cgen_optimize) {
+    str << "\n# " << devirtualized_cnt_ << " of " << dispatch_cnt_
+        << " dispatches devirtualized" << endl;
+    str << "# " << inlined_cnt_ << " calls inlined" << endl;
+    str << "# " << peephole_removed()
+        << " instructions removed by the peephole pass" << endl;
+  }
 }
 
 
@@ -959,11 +1517,11 @@ CgenNodeP CgenClassTable::root()
 ///////////////////////////////////////////////////////////////////////
 void CgenClassTable::code_class_nametabs() {
     str << CLASSNAMETAB << LABEL;
-    int len = class_tag_map_.size();
+    int len = class_by_tag_.size();
 
     StringEntry* str_entry;
     for (int i = 0; i < len; i++) {
-        Symbol name = class_tag_map_[i];
+        Symbol name = class_by_tag_[i]->get_name();
         str_entry = stringtable.lookup_string(name->get_string());
         str << WORD;
         str_entry->code_ref(str);
@@ -973,10 +1531,10 @@ void CgenClassTable::code_class_nametabs() {
 
 void CgenClassTable::code_class_objtabs() {
     str << CLASSOBJTAB << LABEL;
-    int len = class_tag_map_.size();
+    int len = class_by_tag_.size();
     StringEntry* str_entry;
     for (int i = 0; i < len; i++) {
-        Symbol name = class_tag_map_[i];
+        Symbol name = class_by_tag_[i]->get_name();
         str << WORD;
         emit_protobj_ref(name, str);
         str << endl;
@@ -986,184 +1544,482 @@ void CgenClassTable::code_class_objtabs() {
     }
 }
 
+//
+// The lookups below are made while units are coded on several threads,
+// so they use find, never operator[], which may insert.
+//
+CgenNodeP CgenClassTable::get_cgennode(Symbol name) {
+    auto find_cls = name_to_cgen_map_.find(name);
+    return find_cls == name_to_cgen_map_.end() ? nullptr : find_cls->second;
+}
+
+const CgenClassTable::ClassLayout *CgenClassTable::get_layout(Symbol cls) {
+    CgenNodeP node = get_cgennode(cls);
+    return node ? &layouts_[node->get_classtag()] : nullptr;
+}
+
+int CgenClassTable::get_object_size(Symbol cls) {
+    const ClassLayout *layout = get_layout(cls);
+    return (layout ? layout->attrs.size() : 0) + ATTR_BASE_OFFSET;
+}
+
 bool CgenClassTable::get_attr_offset(Symbol cls, Symbol attr, int *offset) {
-    if (attr_offset_map_.find(cls) == attr_offset_map_.end()) {
+    const ClassLayout *layout = get_layout(cls);
+    if (layout == nullptr) {
         return false;
     }
-    if (attr_offset_map_[cls].find(attr) == attr_offset_map_[cls].end()) {
+    auto find_attr = layout->attr_offsets.find(attr);
+    if (find_attr == layout->attr_offsets.end()) {
         return false;
     }
-    *offset = attr_offset_map_[cls][attr];
+    *offset = find_attr->second;
     return true;
 }
 
-bool CgenClassTable::get_meth_offset(Symbol cls1, Symbol cls2, Symbol meth, int *offset) {
-    if (dispatch_tab_map_.find(cls2) == dispatch_tab_map_.end()) {
+bool CgenClassTable::get_meth_offset(Symbol cls, Symbol meth, int *offset) {
+    const ClassLayout *layout = get_layout(cls);
+    if (layout == nullptr) {
         return false;
     }
-    int curr_offset = 0;
-    for (auto &t : dispatch_tab_map_[cls2]) {
-        auto& class_name = t.first;
-        auto& meth_name = t.second;
-        if (class_name == cls2 && meth_name == meth) {
-            *offset = curr_offset;
-            return true;
-        }
-        curr_offset++;
+    auto find_meth = layout->meth_offsets.find(meth);
+    if (find_meth == layout->meth_offsets.end()) {
+        return false;
     }
+    *offset = find_meth->second;
     return true;
 }
 
-bool CgenClassTable::get_meth_offset(Symbol cls, Symbol meth, int *offset) {
-    if (meth_offset_map_.find(cls) == meth_offset_map_.end()) {
+bool CgenClassTable::get_monomorphic_impl(Symbol cls, Symbol meth, Symbol *impl) {
+    const ClassLayout *layout = get_layout(cls);
+    if (layout == nullptr) {
         return false;
     }
-    auto find_meth = meth_offset_map_[cls].find(meth);
-    if (find_meth != meth_offset_map_[cls].end()) {
-        *offset = find_meth->second;
-        return true;
+    auto find_meth = layout->monomorphic.find(meth);
+    if (find_meth == layout->monomorphic.end()) {
+        return false;
     }
-    return false;
+    *impl = find_meth->second;
+    return true;
 }
 
-void CgenClassTable::code_object_disptabs() {
-    List<CgenNode> *nd_list = nds;
-    CgenNode *head;
+bool CgenClassTable::get_exact_impl(Symbol cls, Symbol meth, Symbol *impl) {
+    const ClassLayout *layout = get_layout(cls);
+    if (layout == nullptr) {
+        return false;
+    }
+    auto find_meth = layout->meth_offsets.find(meth);
+    if (find_meth == layout->meth_offsets.end()) {
+        return false;
+    }
+    *impl = layout->disptab[find_meth->second].first;
+    return true;
+}
 
-    for (auto &t : dispatch_tab_map_) {
-        auto& class_name = t.first;
-        auto& distab = t.second;
-        emit_disptable_ref(class_name, str);
-        str << LABEL;
-        for (auto &p : distab) {
-            str << WORD;
-            emit_method_ref(p.first, p.second, str);
-            str << endl;
+method_class *CgenClassTable::get_method(Symbol cls, Symbol meth) {
+    const ClassLayout *layout = get_layout(cls);
+    if (layout == nullptr) {
+        return nullptr;
+    }
+    for (auto method : layout->own_methods) {
+        if (method->get_name() == meth) {
+            return method;
         }
     }
+    return nullptr;
+}
 
+// in a method coded in place of a call, self is the receiver
+CgenNodeP CgenClassTable::get_curr_class() const {
+    if (!curr_unit->inlined.empty()) {
+        return curr_unit->inlined.back().second;
+    }
+    return curr_unit->cls;
 }
 
-void CgenClassTable::code_protobjs() {
-    CgenNodeP curr_cgennode, curr_parent;
-    for (List<CgenNode> *l = nds; l; l = l->tl()) {
-        curr_cgennode = l->hd();
-        Symbol curr_name = curr_cgennode->get_name();
-        str << WORD << -1 << endl;
-        emit_protobj_ref(curr_name, str);
-        str << LABEL;
-        str << WORD << curr_cgennode->get_classtag() << endl;
-        int attr_cnt = class_attr_map_[curr_name].size();
-        auto parents = parent_chain_map_[curr_name];
-        for (auto parent : parents) {
-            Symbol parent_name = parent->get_name();
-            if (parent_name == curr_cgennode->get_name()) {
-                continue;
-            }
-            attr_cnt += class_attr_map_[parent_name].size();
-        }
-        str << WORD << attr_cnt + ATTR_BASE_OFFSET << endl;
-        str << WORD;
-        emit_disptable_ref(curr_name, str);
-        str << endl;
-        int offset = ATTR_BASE_OFFSET; //
-        for (auto parent : parents) {
-            Symbol parent_name = parent->get_name();
-            const auto& curr_attr_list = class_attr_map_[parent_name];
-            for (auto attr : curr_attr_list) {
-                Symbol attr_type = attr->get_type();
-                str << WORD;
-                attr_offset_map_[curr_name][attr->get_name()] = offset++;
-                if (attr_type == Str) {
-                    StringEntry *strentry = stringtable.lookup_string("");
-                    strentry->code_ref(str);
-                } else if (attr_type == Bool) {
-                    falsebool.code_ref(str);
-                } else if (attr_type == Int) {
-                    IntEntry *intentry = inttable.lookup_string("0");
-                    intentry->code_ref(str);
-                } else {
-                    str << 0;
-                }
-                str << endl;
-            }
+int CgenClassTable::get_labelid_and_add() {
+    return curr_unit->labels++;
+}
+
+void CgenClassTable::count_dispatch(bool devirtualized) {
+    curr_unit->dispatch_cnt++;
+    if (devirtualized) curr_unit->devirtualized_cnt++;
+}
+
+#define INLINE_MAX_DEPTH 3   // calls inlined into inlined code, at most
+
+// not the method being coded, nor one being inlined into it
+bool CgenClassTable::can_inline(method_class *meth) const {
+    if (meth == curr_unit->method || curr_unit->inlined.size() >= INLINE_MAX_DEPTH) {
+        return false;
+    }
+    for (auto &m : curr_unit->inlined) {
+        if (m.first == meth) {
+            return false;
         }
     }
+    return true;
 }
 
+void CgenClassTable::enter_inline(method_class *meth, CgenNodeP cls) {
+    curr_unit->inlined.push_back({meth, cls});
+    curr_unit->inlined_cnt++;
+}
 
+void CgenClassTable::exit_inline() {
+    curr_unit->inlined.pop_back();
+}
 
-void CgenClassTable::code_object_inits() {
-    CgenNodeP curr_cgen;
-    for (List<CgenNode> *l = nds; l; l = l->tl()) {
-        curr_cgen = l->hd();
-        curr_cgenclass_ = curr_cgen;
-        emit_init_ref(curr_cgen->get_name(), str);
-        str << LABEL;
-        emit_start_frame(str);
-        envTable->enterframe();
+int CgenClassTable::add_stack_map(const StackMap &map) {
+    curr_unit->stack_maps.push_back(map);
+    return curr_unit->stack_maps.size() - 1;
+}
 
-        CgenNodeP parent = curr_cgen->get_parentnd();
-        if (parent && parent->get_name() != No_class) {
-            str << JAL;
-            emit_init_ref(parent->get_name(), str);
-            str << endl;
-        }
-        // 处理中间的attr,这一部分比较复杂, 只是处理本层的attr
-        const auto& curr_attrs = class_attr_map_[curr_cgen->get_name()];
-        for (auto attr : curr_attrs) {
-            Expression init_expr = attr->get_init();
-            Symbol attr_type = attr->get_type();
-            if (init_expr->get_type() != NULL) {
-                init_expr->code(str);
-                int attr_off = attr_offset_map_[curr_cgen->get_name()][attr->get_name()];
-                emit_store(ACC, attr_off, SELF, str);
-                emit_gc_update(SELF, attr_off, str);
+void CgenClassTable::add_case_table(int id, const std::vector<int> &labels) {
+    curr_unit->case_tables[id] = labels;
+}
+
+//
+// Codes the units on cgen_jobs threads (-j), the calling thread being
+// one of them.  A thread takes the next unit not yet taken until none
+// are left.
+//
+void CgenClassTable::code_units(std::vector<CgenUnit> &units) {
+    std::atomic<int> next(0);
+    auto work = [&]() {
+        EnvTable env;
+        RegAllocator ra;
+        envTable = &env;
+        regAlloc = &ra;
+        for (int i; (i = next++) < (int) units.size(); ) {
+            curr_unit = &units[i];
+            if (units[i].init) {
+                code_object_init(units[i]);
+            } else {
+                code_methods(units[i]);
             }
         }
-        emit_move(ACC, SELF, str);
-        emit_end_frame(str);
-        envTable->exitframe();
-        emit_return(str);
+        curr_unit = nullptr;
+        envTable = nullptr;
+        regAlloc = nullptr;
+    };
+    int jobs = std::min(std::max(cgen_jobs, 1), (int) units.size());
+    std::vector<std::thread> threads;
+    for (int i = 1; i < jobs; i++) {
+        threads.emplace_back(work);
+    }
+    work();
+    for (auto &t : threads) {
+        t.join();
     }
 }
 
-void CgenClassTable::code_methods() {
-    CgenNodeP curr_cgennode;
-    for (List<CgenNode> *l = nds; l; l = l->tl()) {
-        curr_cgennode = l->hd();
-        curr_cgenclass_ = curr_cgennode;
-        Symbol cgenname = curr_cgenclass_->get_name();
-        if (cgenname == Object || cgenname == Str || cgenname == Bool || cgenname == Int || cgenname == IO) { // basic中的method无需做出处理
+// adds base to the number of each prefix<n> in line that is a whole name
+static void shift_ids(std::string &line, const char *prefix, int base) {
+    size_t len = strlen(prefix);
+    for (size_t pos = line.find(prefix); pos != std::string::npos;
+         pos = line.find(prefix, pos + len)) {
+        size_t end = pos + len;
+        while (end < line.size() && isdigit(line[end])) end++;
+        if (end == pos + len ||
+            (pos > 0 && (isalnum(line[pos - 1]) || line[pos - 1] == '_' || line[pos - 1] == '.')) ||
+            (end < line.size() && (isalnum(line[end]) || line[end] == '_' || line[end] == '.'))) {
             continue;
         }
-        // 只处理本层的method
-        const auto& methods = class_method_map_[cgenname];
-        Formals curr_formals;
-        std::list<Formal> formal_list;
-        for (auto method : methods) {
-            formal_list.clear();
-            envTable->enterframe();
-            curr_formals = method->formals;
-            for (int i = curr_formals->first(); curr_formals->more(i); i = curr_formals->next(i)) {
-                formal_list.push_front(curr_formals->nth(i));
-            }
-            for (auto formal : formal_list) {
-                envTable->add_formal_id(formal->get_name());
+        std::string id = std::to_string(atoi(line.c_str() + pos + len) + base);
+        line.replace(pos + len, end - pos - len, id);
+    }
+}
+
+//
+// Writes a unit's code, with its labels, jump tables and stack maps
+// numbered after those of the units already written.  A return label
+// goes after each call that names a stack map, and the jump tables the
+// code still uses are noted.  Calls and cases the passes removed take
+// their maps and tables with them, and the return labels come out in
+// address order.
+//
+void CgenClassTable::place_unit(const CgenUnit &u, ostream &s) {
+    static const std::string marker = "\t# stackmap ";
+    static const std::string table = "\t# " CASETAB_PREFIX;
+    // jump tables are numbered with the labels
+    int label_base = placed_labels_;
+    int map_base = stack_maps_.size();
+    placed_labels_ += u.labels;
+    stack_maps_.insert(stack_maps_.end(), u.stack_maps.begin(), u.stack_maps.end());
+    for (auto &t : u.case_tables) {
+        std::vector<int> &labels = case_tables_[t.first + label_base];
+        for (int label : t.second) {
+            labels.push_back(label + label_base);
+        }
+    }
+    dispatch_cnt_ += u.dispatch_cnt;
+    devirtualized_cnt_ += u.devirtualized_cnt;
+    inlined_cnt_ += u.inlined_cnt;
+
+    std::istringstream lines(u.text.str());
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (label_base) {
+            shift_ids(line, "label", label_base);
+            shift_ids(line, CASETAB_PREFIX, label_base);
+        }
+        size_t pos = line.find(marker);
+        if (pos == std::string::npos) {
+            pos = line.find(table);
+            if (pos != std::string::npos) {
+                placed_case_tables_.push_back(
+                    atoi(line.c_str() + pos + table.size()));
             }
-            emit_method_ref(curr_cgenclass_->get_name(), method->get_name(), str);
-            str << LABEL;
-            emit_start_frame(str);
-            method->expr->code(str);
-            emit_end_frame(str);
-            emit_addiu(SP, SP, formal_list.size() * WORD_SIZE, str);
-            emit_return(str);
-            envTable->exitframe();
+            s << line << endl;
+            continue;
         }
+        int id = atoi(line.c_str() + pos + marker.size()) + map_base;
+        s << line.substr(0, pos) << endl;
+        s << CALLSITE_PREFIX << id << LABEL;
+        placed_maps_.push_back(id);
     }
 }
 
-///////////////////////////////////////////////////////////////////////
+//
+// Stack maps let the collectors find the pointers on the stack exactly
+// instead of guessing.  The table lists the return address of every
+// call that may collect garbage with its map, in address order:
+//
+//      .word   n
+//      .word   callsite<id>, stackmap<id>      (n times)
+//
+// A map is five words and a list of offsets:
+//
+//      depth   words in use below $fp, the saved registers too
+//      args    argument words above the frame, from 12($fp)
+//      regs    REG mask of the registers $s1-$s6 holding pointers
+//      saves   4 bits per register from $s1: n if the routine saved
+//              it in -4n($fp)
+//      n       number of offsets that follow
+//      ...     $fp offsets in bytes of the slots holding pointers
+//
+// Routines with the same map at several calls share one.  The table is
+// handed to the runtime by a stub that the runtime calls in place of the
+// collector's initialization (see _MemMgr_INITIALIZER).
+//
+void CgenClassTable::code_stack_maps() {
+    str << "\t.text" << endl;
+    str << STACKMAPTAB << CLASSINIT_SUFFIX << LABEL;
+    emit_load_address(T1, STACKMAPTAB, str);
+    emit_load_address(T2, STACKMAPS, str);
+    emit_store(T1, 0, T2, str);
+    str << "\tj\t" << gc_init_names[cgen_Memmgr] << endl;
+    str << "\t.data" << endl << ALIGN;
+
+    std::map<std::vector<int>, int> shared;
+    std::vector<int> record(placed_maps_.size());
+    for (int i = 0; i < (int) placed_maps_.size(); i++) {
+        const StackMap &map = stack_maps_[placed_maps_[i]];
+        std::vector<int> key = { map.depth, map.args, map.regs, map.saves };
+        key.insert(key.end(), map.slots.begin(), map.slots.end());
+        auto it = shared.insert({key, placed_maps_[i]}).first;
+        record[i] = it->second;
+    }
+    str << STACKMAPTAB << LABEL;
+    str << WORD << placed_maps_.size() << endl;
+    for (int i = 0; i < (int) placed_maps_.size(); i++) {
+        str << WORD << CALLSITE_PREFIX << placed_maps_[i] << endl;
+        str << WORD << STACKMAP_PREFIX << record[i] << endl;
+    }
+    for (auto &entry : shared) {
+        const StackMap &map = stack_maps_[entry.second];
+        str << STACKMAP_PREFIX << entry.second << LABEL;
+        str << WORD << map.depth << endl;
+        str << WORD << map.args << endl;
+        str << WORD << map.regs << endl;
+        str << WORD << map.saves << endl;
+        str << WORD << map.slots.size() << endl;
+        for (int slot : map.slots) {
+            str << WORD << slot * WORD_SIZE << endl;
+        }
+    }
+}
+
+//
+// The jump tables of the cases coded with one (see typcase_class::code):
+// for each class tag from the lowest one a branch matches, the label of
+// the branch that handles it, or of the code for no match.
+//
+void CgenClassTable::code_case_tables() {
+    for (int id : placed_case_tables_) {
+        str << CASETAB_PREFIX << id << LABEL;
+        for (int label : case_tables_[id]) {
+            str << WORD;
+            emit_label_ref(label, str);
+            str << endl;
+        }
+    }
+}
+
+void CgenClassTable::code_object_disptabs() {
+    for (List<CgenNode> *l = nds; l; l = l->tl()) {
+        Symbol class_name = l->hd()->get_name();
+        emit_disptable_ref(class_name, str);
+        str << LABEL;
+        for (auto &p : layouts_[l->hd()->get_classtag()].disptab) {
+            str << WORD;
+            emit_method_ref(p.first, p.second, str);
+            str << endl;
+        }
+    }
+
+}
+
+void CgenClassTable::code_protobjs() {
+    CgenNodeP curr_cgennode;
+    for (List<CgenNode> *l = nds; l; l = l->tl()) {
+        curr_cgennode = l->hd();
+        Symbol curr_name = curr_cgennode->get_name();
+        const auto &attrs = layouts_[curr_cgennode->get_classtag()].attrs;
+        str << WORD << -1 << endl;
+        emit_protobj_ref(curr_name, str);
+        str << LABEL;
+        str << WORD << curr_cgennode->get_classtag() << endl;
+        str << WORD << attrs.size() + ATTR_BASE_OFFSET << endl;
+        str << WORD;
+        emit_disptable_ref(curr_name, str);
+        str << endl;
+        for (auto attr : attrs) {
+            Symbol attr_type = attr->get_type();
+            str << WORD;
+            if (attr_type == Str) {
+                StringEntry *strentry = stringtable.lookup_string("");
+                strentry->code_ref(str);
+            } else if (attr_type == Bool) {
+                falsebool.code_ref(str);
+            } else if (attr_type == Int) {
+                IntEntry *intentry = inttable.lookup_string("0");
+                intentry->code_ref(str);
+            } else {
+                str << 0;
+            }
+            str << endl;
+        }
+    }
+}
+
+
+
+void CgenClassTable::code_object_init(CgenUnit &u) {
+    CgenNodeP curr_cgen = u.cls;
+    std::ostringstream code, body;
+    envTable->enterframe(cgen_optimize);
+
+    const auto& curr_attrs = layouts_[curr_cgen->get_classtag()].own_attrs;
+    regAlloc->clear();
+    if (reg_alloc_enabled()) {
+        for (auto attr : curr_attrs) {
+            if (!is_no_expr(attr->get_init())) {
+                attr->get_init()->alloc_regs(*regAlloc);
+            }
+        }
+        regAlloc->allocate();
+    }
+    reserve_save_slots();
+    int first_map = u.stack_maps.size();
+
+    // under -O a parent _init that does nothing is not called
+    CgenNodeP parent = curr_cgen->get_parentnd();
+    if (parent && parent->get_name() != No_class &&
+        !(cgen_optimize && layouts_[parent->get_classtag()].no_inits)) {
+        body << JAL;
+        emit_init_ref(parent->get_name(), body);
+        emit_stack_map(body);
+    }
+    // 处理中间的attr,这一部分比较复杂, 只是处理本层的attr
+    for (auto attr : curr_attrs) {
+        Expression init_expr = attr->get_init();
+        Symbol attr_type = attr->get_type();
+        if (!is_no_expr(init_expr)) {
+            init_expr->code(body);
+            int attr_off;
+            get_attr_offset(curr_cgen->get_name(), attr->get_name(), &attr_off);
+            emit_store(ACC, attr_off, SELF, body);
+            emit_gc_update(SELF, attr_off, body);
+        }
+    }
+    int words = envTable->frame_words();
+    place_frame(u, first_map, words);
+
+    std::ostringstream inner;
+    emit_save_regs(inner);
+    inner << body.str();
+    emit_move(ACC, SELF, inner);
+    emit_restore_regs(inner);
+    emit_init_ref(curr_cgen->get_name(), code);
+    code << LABEL;
+    emit_frame(inner.str(), words, code);
+    envTable->exitframe();
+    emit_return(code);
+    emit_routine(code.str(), u);
+}
+
+void CgenClassTable::code_methods(CgenUnit &u) {
+    CgenNodeP curr_cgennode = u.cls;
+    Symbol cgenname = curr_cgennode->get_name();
+    if (cgenname == Object || cgenname == Str || cgenname == Bool || cgenname == Int || cgenname == IO) { // basic中的method无需做出处理
+        return;
+    }
+    // 只处理本层的method
+    const auto& methods = layouts_[curr_cgennode->get_classtag()].own_methods;
+    Formals curr_formals;
+    std::list<Formal> formal_list;
+    for (auto method : methods) {
+        u.method = method;
+        formal_list.clear();
+        std::ostringstream code, body;
+        envTable->enterframe(cgen_optimize);
+        curr_formals = method->formals;
+        for (int i = curr_formals->first(); curr_formals->more(i); i = curr_formals->next(i)) {
+            formal_list.push_front(curr_formals->nth(i));
+        }
+        regAlloc->clear();
+        if (reg_alloc_enabled()) {
+            for (auto formal : formal_list) {
+                regAlloc->open(formal);
+            }
+            method->expr->alloc_regs(*regAlloc);
+            for (auto formal : formal_list) {
+                regAlloc->close(formal);
+            }
+            regAlloc->allocate();
+        }
+        for (auto formal : formal_list) {
+            envTable->add_formal_id(formal->get_name(), regAlloc->reg(formal));
+        }
+        reserve_save_slots();
+        int first_map = u.stack_maps.size();
+        for (auto formal : formal_list) {   // 参数放入分配的寄存器
+            const EnvTable::Binding *b = envTable->find(formal->get_name());
+            if (b->reg) {
+                emit_load(b->reg, b->offset, FP, body);
+            }
+        }
+        method->expr->code(body);
+        int words = envTable->frame_words();
+        place_frame(u, first_map, words);
+
+        std::ostringstream inner;
+        emit_save_regs(inner);
+        inner << body.str();
+        emit_restore_regs(inner);
+        emit_method_ref(cgenname, method->get_name(), code);
+        code << LABEL;
+        emit_frame(inner.str(), words, code);
+        emit_addiu(SP, SP, formal_list.size() * WORD_SIZE, code);
+        emit_return(code);
+        envTable->exitframe();
+        emit_routine(code.str(), u);
+    }
+    u.method = nullptr;
+}
+
+///////////////////////////////////////////////////////////////////////
 //
 // CgenNode methods
 //
@@ -1190,10 +2046,37 @@ CgenNode::CgenNode(Class_ nd, Basicness bstatus, CgenClassTableP ct) :
 //
 //*****************************************************************
 
+//
+// Code for an expression whose value is not used.  An Int or Bool value
+// need not be boxed.
+//
+static void code_effect(Expression e, ostream &s) {
+    if (is_unboxed_type(e->get_type())) {
+        e->code_unboxed(s);
+    } else {
+        e->code(s);
+    }
+}
+
+void Expression_class::code_unboxed(ostream &s) {
+    code(s);
+    emit_fetch_int(ACC, ACC, s);
+}
+
 void assign_class::code(ostream &s) {
-    expr->code(s);
     CgenNodeP curr_cgen = codegen_classtable->get_curr_class();
     int offset;
+    const EnvTable::Binding *local = envTable->find(name);
+    if (local && local->unboxed) {
+        code_unboxed(s);
+        emit_box(get_type(), s);
+        return;
+    }
+    expr->code(s);
+    if (local && local->reg) {
+        emit_store_local(local, s);
+        return;
+    }
     if (envTable->lookup(name, &offset)) {
         emit_store(ACC, offset, FP, s);
         emit_gc_update(FP, offset, s);
@@ -1205,14 +2088,116 @@ void assign_class::code(ostream &s) {
     }
 }
 
+void assign_class::code_unboxed(ostream &s) {
+    const EnvTable::Binding *local = envTable->find(name);
+    if (!local || !local->unboxed) {
+        Expression_class::code_unboxed(s);
+        return;
+    }
+    expr->code_unboxed(s);
+    emit_store_local(local, s);
+}
+
+//
+// Inlining (-O).
+//
+// A call whose method is known when the code is generated, and whose
+// body has at most cgen_inline_size nodes (-i), is coded in place of the
+// call.  The method is known for a static dispatch, for a dispatch of a
+// method no subclass of the receiver's class overrides (which takes in
+// calls on self in such a class), and for a dispatch on `new T'.  The
+// arguments are kept in slots of the frame, which are the formals of
+// the body, and the body sees none of the caller's names.  While it
+// runs self is the receiver, with the caller's self kept in a slot; a
+// call on self needs neither.  Methods are inlined up to
+// INLINE_MAX_DEPTH deep and never into themselves.
+//
+static method_class *inline_target(Symbol impl, Symbol meth) {
+    if (!cgen_optimize || cgen_inline_size == 0) {
+        return nullptr;
+    }
+    CgenNodeP cls = codegen_classtable->get_cgennode(impl);
+    if (!cls || cls->basic()) {   // coded in the runtime
+        return nullptr;
+    }
+    method_class *method = codegen_classtable->get_method(impl, meth);
+    if (!method || !codegen_classtable->can_inline(method) ||
+        method->get_body_expr()->size() > cgen_inline_size) {
+        return nullptr;
+    }
+    return method;
+}
+
+// the class of the value of e, with SELF_TYPE the current class
+static CgenNodeP static_class(Expression e) {
+    if (e->get_type() == SELF_TYPE) {
+        return codegen_classtable->get_curr_class();
+    }
+    return codegen_classtable->get_cgennode(e->get_type());
+}
+
+static void code_inline(method_class *method, Expression expr, Expressions actual,
+                        int lineno, ostream &s) {
+    std::vector<int> arg_slots;
+    for (int i = actual->first(); actual->more(i); i = actual->next(i)) {
+        actual->nth(i)->code(s);
+        arg_slots.push_back(envTable->next_slot());
+        emit_push_slot(ACC, s);
+        envTable->push_temp();
+    }
+    CgenNodeP cls = static_class(expr);
+    expr->code(s);
+    object_class *obj = dynamic_cast<object_class *>(expr);
+    bool on_self = obj && obj->name == self;
+    if (!on_self && !dynamic_cast<new__class *>(expr)) {
+        int lebalid = codegen_classtable->get_labelid_and_add();
+        emit_abort(lebalid, lineno, s);
+        emit_label_def(lebalid, s);
+    }
+    if (!on_self) {
+        emit_push_slot(SELF, s);
+        envTable->push_temp();
+        emit_move(SELF, ACC, s);
+    }
+    envTable->enterscope(true);
+    Formals formals = method->get_formals();
+    for (int i = formals->first(), k = 0; formals->more(i); i = formals->next(i), k++) {
+        envTable->add_slot_id(formals->nth(i)->get_name(), arg_slots[k]);
+    }
+    codegen_classtable->enter_inline(method, cls);
+    method->get_body_expr()->code(s);
+    codegen_classtable->exit_inline();
+    envTable->exitscope();
+    if (!on_self) {
+        envTable->pop_temp();
+        emit_load_slot(SELF, s);
+        emit_pop_slot(s);
+    }
+    envTable->pop_temp(arg_slots.size());
+    for (size_t i = 0; i < arg_slots.size(); i++) {
+        emit_pop_slot(s);
+    }
+}
+
 void static_dispatch_class::code(ostream &s) {
+    Symbol impl;
+    method_class *target = nullptr;
+    if (codegen_classtable->get_exact_impl(type_name, name, &impl)) {
+        target = inline_target(impl, name);
+    }
+    if (target) {
+        code_inline(target, expr, actual, get_line_number(), s);
+        return;
+    }
     Expression curr_expr;
     for (int i = actual->first(); actual->more(i); i = actual->next(i)) {
         curr_expr = actual->nth(i);
         curr_expr->code(s);
         emit_push(ACC, s);
+        envTable->push_arg();
     }
     expr->code(s);
+    envTable->pop_args(actual->len());
 
     int lebalid = codegen_classtable->get_labelid_and_add();
 
@@ -1230,23 +2215,46 @@ void static_dispatch_class::code(ostream &s) {
 }
 
 void dispatch_class::code(ostream &s) {
+    Symbol expr_type = expr->get_type();
+    if (expr_type == SELF_TYPE) {
+        expr_type = codegen_classtable->get_curr_class()->get_name();
+    }
+    // under -O, call a method no subclass overrides, or the method of a
+    // new object, directly, or code it in place
+    Symbol impl;
+    new__class *alloc = dynamic_cast<new__class *>(expr);
+    bool direct = cgen_optimize &&
+        (codegen_classtable->get_monomorphic_impl(expr_type, name, &impl) ||
+         (alloc && alloc->type_name != SELF_TYPE &&
+          codegen_classtable->get_exact_impl(expr_type, name, &impl)));
+    method_class *target = direct ? inline_target(impl, name) : nullptr;
+    if (target) {
+        codegen_classtable->count_dispatch(true);
+        code_inline(target, expr, actual, get_line_number(), s);
+        return;
+    }
     // 首先将参数全部压栈
     Expression curr_expr;
     for (int i = actual->first(); actual->more(i); i = actual->next(i)) {
         curr_expr = actual->nth(i);
         curr_expr->code(s);
         emit_push(ACC, s);
+        envTable->push_arg();
     }
     expr->code(s);
+    envTable->pop_args(actual->len());
     int lebalid = codegen_classtable->get_labelid_and_add();
     emit_abort(lebalid, get_line_number(), s);
     emit_label_def(lebalid, s);
+    codegen_classtable->count_dispatch(direct);
+    if (direct) {
+        s << JAL;
+        emit_method_ref(impl, name, s);
+        emit_stack_map(s);
+        return;
+    }
     emit_load(T1, DISPTABLE_OFFSET, ACC, s); // 将dispacth表加载到T1中
     int offset;
-    Symbol expr_type = expr->get_type();
-    if (expr_type == SELF_TYPE) {
-        expr_type = codegen_classtable->get_curr_class()->get_name();
-    }
     codegen_classtable->get_meth_offset(expr_type, name, &offset);
     emit_load(T1, offset, T1, s); // 获取该dispatch的地址
 
@@ -1254,19 +2262,43 @@ void dispatch_class::code(ostream &s) {
 }
 
 void cond_class::code(ostream &s) {
-    pred->code(s);
-    emit_load(T1, ATTR_BASE_OFFSET, ACC, s);
-    emit_move(T2, ZERO, s);
+    code_cond(s, false);
+}
+
+void cond_class::code_unboxed(ostream &s) {
+    code_cond(s, true);
+}
+
+void cond_class::code_cond(ostream &s, bool unboxed) {
+    if (cgen_optimize) {
+        pred->code_unboxed(s);
+    } else {
+        pred->code(s);
+        emit_load(T1, ATTR_BASE_OFFSET, ACC, s);
+        emit_move(T2, ZERO, s);
+    }
 
     int out_lebal = codegen_classtable->get_labelid_and_add();
     int false_lebal = codegen_classtable->get_labelid_and_add();
 
-    emit_beq(T1, T2, false_lebal, s);
-    then_exp->code(s);
+    if (cgen_optimize) {
+        emit_beqz(ACC, false_lebal, s);
+    } else {
+        emit_beq(T1, T2, false_lebal, s);
+    }
+    if (unboxed) {
+        then_exp->code_unboxed(s);
+    } else {
+        then_exp->code(s);
+    }
     emit_branch(out_lebal, s);
 
     emit_label_def(false_lebal, s);
-    else_exp->code(s);
+    if (unboxed) {
+        else_exp->code_unboxed(s);
+    } else {
+        else_exp->code(s);
+    }
     emit_label_def(out_lebal, s);
 }
 
@@ -1275,17 +2307,27 @@ void loop_class::code(ostream &s) {
     int end_lebal = codegen_classtable->get_labelid_and_add();
 
     emit_label_def(start_lebal, s);
-    pred->code(s);
-    emit_load(T1, ATTR_BASE_OFFSET, ACC, s);
-    emit_beq(T1, ZERO, end_lebal, s); // 条件等于0时结束
+    if (cgen_optimize) {
+        pred->code_unboxed(s);
+        emit_beqz(ACC, end_lebal, s);
+    } else {
+        pred->code(s);
+        emit_load(T1, ATTR_BASE_OFFSET, ACC, s);
+        emit_beq(T1, ZERO, end_lebal, s); // 条件等于0时结束
+    }
 
-    body->code(s);
+    code_effect(body, s);
     emit_branch(start_lebal, s); // 跳转回去
     emit_label_def(end_lebal, s); // 结束循环对应的lebal
 
     emit_move(ACC, ZERO, s);
 }
 
+// under -O a case is coded with a jump table if it has this many
+// branches, and the table has at most this many words a branch
+#define CASE_TABLE_MIN_BRANCHES     3
+#define CASE_TABLE_SPAN_PER_BRANCH  8
+
 void typcase_class::code(ostream &s) {
     expr->code(s);
     int no_void_lebal = codegen_classtable->get_labelid_and_add();
@@ -1309,22 +2351,94 @@ void typcase_class::code(ostream &s) {
             codegen_classtable->get_cgennode(b->get_type_decl())->get_chain_depth();
     };
     std::sort(sorted_cases.begin(), sorted_cases.end(), sort_comp);
+
+    //
+    // The tags of a class and its descendants are a range, so the branch
+    // for a tag is the first one, deepest first, whose range holds it.
+    // With enough branches over few enough tags, a jump table indexed by
+    // the tag finds it at once instead of testing the ranges in turn.
+    //
+    int low_tag = INT_MAX, high_tag = INT_MIN;
     for (auto case_class : sorted_cases) {
+        CgenNodeP cgen = codegen_classtable->get_cgennode(case_class->get_type_decl());
+        low_tag = std::min(low_tag, cgen->get_classtag());
+        high_tag = std::max(high_tag, cgen->get_classtag() + cgen->get_descendants_cnt());
+    }
+    int span = high_tag - low_tag + 1;
+    bool table = cgen_optimize && (int) sorted_cases.size() >= CASE_TABLE_MIN_BRANCHES
+                 && span <= CASE_TABLE_SPAN_PER_BRANCH * (int) sorted_cases.size();
+    std::vector<int> branch_lebals;
+    if (table) {
+        std::vector<int> labels(span, notmatch_lebal);
+        for (auto case_class : sorted_cases) {
+            CgenNodeP cgen = codegen_classtable->get_cgennode(case_class->get_type_decl());
+            int lebal = codegen_classtable->get_labelid_and_add();
+            branch_lebals.push_back(lebal);
+            for (int tag = cgen->get_classtag();
+                 tag <= cgen->get_classtag() + cgen->get_descendants_cnt(); tag++) {
+                if (labels[tag - low_tag] == notmatch_lebal) {
+                    labels[tag - low_tag] = lebal;
+                }
+            }
+        }
+        int id = codegen_classtable->get_labelid_and_add();
+        codegen_classtable->add_case_table(id, labels);
+        // every tag is from 0 to the root's last descendant
+        if (low_tag > 0) {
+            emit_blti(T1, low_tag, notmatch_lebal, s);
+        }
+        if (high_tag < codegen_classtable->root()->get_descendants_cnt()) {
+            emit_bgti(T1, high_tag, notmatch_lebal, s);
+        }
+        emit_sll(T1, T1, 2, s);
+        s << LA << T2 << " " << CASETAB_PREFIX << id << endl;
+        emit_addu(T2, T2, T1, s);
+        emit_load(T2, -low_tag, T2, s);
+        // the comment names the table for place_unit; the IR passes
+        // are told where the jump may go
+        s << "\tjr\t" << T2 << "\t# " << CASETAB_PREFIX << id << endl;
+        std::vector<int> targets = branch_lebals;
+        targets.push_back(notmatch_lebal);
+        std::vector<std::string> names;
+        for (int lebal : targets) {
+            std::ostringstream name;
+            emit_label_ref(lebal, name);
+            names.push_back(name.str());
+        }
+        curr_unit->routine.switch_targets.push_back(names);
+    }
+
+    for (int i = 0; i < (int) sorted_cases.size(); i++) {
+        Case case_class = sorted_cases[i];
         Symbol cgen_type = case_class->get_type_decl();
         CgenNodeP cgen = codegen_classtable->get_cgennode(cgen_type);
-        int next_case_lebal = codegen_classtable->get_labelid_and_add();
-        int start_tag = cgen->get_classtag();
-        int end_tag = start_tag + cgen->get_descendants_cnt();
-        emit_blti(T1, start_tag, next_case_lebal, s);
-        emit_bgti(T1, end_tag, next_case_lebal, s);
-        emit_push(ACC, s);
+        int next_case_lebal = -1;
+        if (table) {
+            emit_label_def(branch_lebals[i], s);
+        } else {
+            next_case_lebal = codegen_classtable->get_labelid_and_add();
+            int start_tag = cgen->get_classtag();
+            int end_tag = start_tag + cgen->get_descendants_cnt();
+            emit_blti(T1, start_tag, next_case_lebal, s);
+            emit_bgti(T1, end_tag, next_case_lebal, s);
+        }
+        char *reg = regAlloc->reg(case_class);
+        if (reg) {
+            emit_move(reg, ACC, s);
+        } else {
+            emit_push_slot(ACC, s);
+        }
         envTable->enterscope();
-        envTable->add_local_id(case_class->get_name());
+        envTable->add_local_id(case_class->get_name(), false, reg);
         case_class->get_expr()->code(s);
         envTable->exitscope();
-        emit_addiu(SP, SP, 4, s);
+        if (!reg) {
+            emit_pop_slot(s);
+        }
         emit_branch(out_lebal, s);
-        emit_label_def(next_case_lebal, s);
+        if (!table) {
+            emit_label_def(next_case_lebal, s);
+        }
     }
     emit_label_def(notmatch_lebal, s);
     emit_jal("_case_abort", s);
@@ -1336,13 +2450,45 @@ void block_class::code(ostream &s) {
     Expression expr;
     for (int i = exprs->first(); exprs->more(i); i = exprs->next(i)) {
         expr = exprs->nth(i);
-        expr->code(s);
+        if (exprs->more(exprs->next(i))) {
+            code_effect(expr, s);
+        } else {
+            expr->code(s);
+        }
+    }
+}
+
+void block_class::code_unboxed(ostream &s) {
+    Expressions exprs = body;
+    Expression expr;
+    for (int i = exprs->first(); exprs->more(i); i = exprs->next(i)) {
+        expr = exprs->nth(i);
+        if (exprs->more(exprs->next(i))) {
+            code_effect(expr, s);
+        } else {
+            expr->code_unboxed(s);
+        }
     }
 }
 
 void let_class::code(ostream &s) {
-    init->code(s);
-    if (init->get_type() == NULL) { // 如果初始化表达式是空的，初始化为默认值
+    code_let(s, false);
+}
+
+void let_class::code_unboxed(ostream &s) {
+    code_let(s, true);
+}
+
+void let_class::code_let(ostream &s, bool unboxed) {
+    bool raw = is_unboxed_type(type_decl); // 变量保存未装箱的值
+    if (raw && is_no_expr(init)) {
+        emit_load_imm(ACC, 0, s);
+    } else if (raw) {
+        init->code_unboxed(s);
+    } else {
+        init->code(s);
+    }
+    if (!raw && is_no_expr(init)) { // 如果初始化表达式是空的，初始化为默认值
         if (type_decl == Int) {
             emit_load_int(ACC, inttable.lookup_string("0"), s);
         } else if (type_decl == Str) {
@@ -1352,76 +2498,150 @@ void let_class::code(ostream &s) {
         }
     }
 
-    emit_push(ACC, s); // 入栈
+    char *reg = regAlloc->reg(this);
+    if (reg) {
+        emit_move(reg, ACC, s);
+    } else {
+        emit_push_slot(ACC, s); // 入栈
+    }
     envTable->enterscope();
-    envTable->add_local_id(identifier);  // 加入到环境表
-    body->code(s);
+    envTable->add_local_id(identifier, raw, reg);  // 加入到环境表
+    if (unboxed) {
+        body->code_unboxed(s);
+    } else {
+        body->code(s);
+    }
 
     envTable->exitscope();
-    emit_addiu(SP, SP, 4, s);
+    if (!reg) {
+        emit_pop_slot(s);
+    }
 }
 
 void plus_class::code(ostream &s) {
+    if (cgen_optimize) {
+        code_unboxed(s);
+        emit_box_int(s);
+        return;
+    }
     e1->code(s);
-    emit_push(ACC, s);
+    emit_push_slot(ACC, s);
+    envTable->push_temp();
     e2->code(s);
-    emit_jal("Object.copy", s);
-    emit_load(T1, 1, SP, s);
+    emit_gc_jal("Object.copy", s);
+    envTable->pop_temp();
+    emit_load_slot(T1, s);
     emit_load(T2, ATTR_BASE_OFFSET, T1, s);
     emit_load(T3, ATTR_BASE_OFFSET, ACC, s);
-    emit_addiu(SP, SP, 4, s);
+    emit_pop_slot(s);
     emit_add(T3, T2, T3, s);
     emit_store(T3, ATTR_BASE_OFFSET, ACC, s);
 }
 
+void plus_class::code_unboxed(ostream &s) {
+    emit_unboxed_t1_acc(s, e1, e2, regAlloc->reg(this));
+    emit_add(ACC, T1, ACC, s);
+}
+
 void sub_class::code(ostream &s) {
+    if (cgen_optimize) {
+        code_unboxed(s);
+        emit_box_int(s);
+        return;
+    }
     e1->code(s);
-    emit_push(ACC, s);
+    emit_push_slot(ACC, s);
+    envTable->push_temp();
     e2->code(s);
-    emit_jal("Object.copy", s);
-    emit_load(T1, 1, SP, s);
+    emit_gc_jal("Object.copy", s);
+    envTable->pop_temp();
+    emit_load_slot(T1, s);
     emit_load(T2, ATTR_BASE_OFFSET, T1, s);
     emit_load(T3, ATTR_BASE_OFFSET, ACC, s);
-    emit_addiu(SP, SP, 4, s);
+    emit_pop_slot(s);
     emit_sub(T3, T2, T3, s);
     emit_store(T3, ATTR_BASE_OFFSET, ACC, s);
 }
 
+void sub_class::code_unboxed(ostream &s) {
+    emit_unboxed_t1_acc(s, e1, e2, regAlloc->reg(this));
+    emit_sub(ACC, T1, ACC, s);
+}
+
 void mul_class::code(ostream &s) {
+    if (cgen_optimize) {
+        code_unboxed(s);
+        emit_box_int(s);
+        return;
+    }
     e1->code(s);
-    emit_push(ACC, s);
+    emit_push_slot(ACC, s);
+    envTable->push_temp();
     e2->code(s);
-    emit_jal("Object.copy", s);
-    emit_load(T1, 1, SP, s);
+    emit_gc_jal("Object.copy", s);
+    envTable->pop_temp();
+    emit_load_slot(T1, s);
     emit_load(T2, ATTR_BASE_OFFSET, T1, s);
     emit_load(T3, ATTR_BASE_OFFSET, ACC, s);
-    emit_addiu(SP, SP, 4, s);
+    emit_pop_slot(s);
     emit_mul(T3, T2, T3, s);
     emit_store(T3, ATTR_BASE_OFFSET, ACC, s);
 }
 
+void mul_class::code_unboxed(ostream &s) {
+    emit_unboxed_t1_acc(s, e1, e2, regAlloc->reg(this));
+    emit_mul(ACC, T1, ACC, s);
+}
+
 void divide_class::code(ostream &s) {
+    if (cgen_optimize) {
+        code_unboxed(s);
+        emit_box_int(s);
+        return;
+    }
     e1->code(s);
-    emit_push(ACC, s);
+    emit_push_slot(ACC, s);
+    envTable->push_temp();
     e2->code(s);
-    emit_jal("Object.copy", s);
-    emit_load(T1, 1, SP, s);
+    emit_gc_jal("Object.copy", s);
+    envTable->pop_temp();
+    emit_load_slot(T1, s);
     emit_load(T2, ATTR_BASE_OFFSET, T1, s);
     emit_load(T3, ATTR_BASE_OFFSET, ACC, s);
-    emit_addiu(SP, SP, 4, s);
+    emit_pop_slot(s);
     emit_div(T3, T2, T3, s);
     emit_store(T3, ATTR_BASE_OFFSET, ACC, s);
 }
 
+void divide_class::code_unboxed(ostream &s) {
+    emit_unboxed_t1_acc(s, e1, e2, regAlloc->reg(this));
+    emit_div(ACC, T1, ACC, s);
+}
+
 void neg_class::code(ostream &s) {
+    if (cgen_optimize) {
+        code_unboxed(s);
+        emit_box_int(s);
+        return;
+    }
     e1->code(s);
-    emit_jal("Object.copy", s);
+    emit_gc_jal("Object.copy", s);
     emit_load(T1, ATTR_BASE_OFFSET, ACC, s);
     emit_neg(T1, T1, s);
     emit_store(T1, ATTR_BASE_OFFSET, ACC, s);
 }
 
+void neg_class::code_unboxed(ostream &s) {
+    e1->code_unboxed(s);
+    emit_neg(ACC, ACC, s);
+}
+
 void lt_class::code(ostream &s) {
+    if (cgen_optimize) {
+        code_unboxed(s);
+        emit_box_bool(s);
+        return;
+    }
     emit_load_t1_t2(s, e1, e2);
     emit_load(T1, ATTR_BASE_OFFSET, T1, s);
     emit_load(T2, ATTR_BASE_OFFSET, T2, s);
@@ -1432,8 +2652,18 @@ void lt_class::code(ostream &s) {
     emit_label_def(out_lebal, s);
 }
 
+void lt_class::code_unboxed(ostream &s) {
+    emit_unboxed_t1_acc(s, e1, e2, regAlloc->reg(this));
+    emit_slt(ACC, T1, ACC, s);
+}
+
 void eq_class::code(ostream &s) {
-    emit_load_t1_t2(s, e1, e2);
+    if (is_unboxed_type(e1->get_type())) {
+        code_unboxed(s);
+        emit_box_bool(s);
+        return;
+    }
+    emit_load_t1_t2(s, e1, e2, regAlloc->reg(this));
     Symbol e1type = e1->get_type();
     Symbol e2type = e2->get_type();
     if ((e1type == Int || e1type == Bool || e1type == Str)
@@ -1451,7 +2681,22 @@ void eq_class::code(ostream &s) {
     emit_label_def(lebalid, s);
 }
 
+// Int = Int and Bool = Bool compare the raw values
+void eq_class::code_unboxed(ostream &s) {
+    if (!is_unboxed_type(e1->get_type())) {
+        Expression_class::code_unboxed(s);
+        return;
+    }
+    emit_unboxed_t1_acc(s, e1, e2, regAlloc->reg(this));
+    emit_seq(ACC, T1, ACC, s);
+}
+
 void leq_class::code(ostream &s) {
+    if (cgen_optimize) {
+        code_unboxed(s);
+        emit_box_bool(s);
+        return;
+    }
     emit_load_t1_t2(s, e1, e2);
     emit_load(T1, ATTR_BASE_OFFSET, T1, s);
     emit_load(T2, ATTR_BASE_OFFSET, T2, s);
@@ -1463,7 +2708,17 @@ void leq_class::code(ostream &s) {
     emit_label_def(lebalid, s);
 }
 
+void leq_class::code_unboxed(ostream &s) {
+    emit_unboxed_t1_acc(s, e1, e2, regAlloc->reg(this));
+    emit_sle(ACC, T1, ACC, s);
+}
+
 void comp_class::code(ostream &s) {
+    if (cgen_optimize) {
+        code_unboxed(s);
+        emit_box_bool(s);
+        return;
+    }
     e1->code(s);
     emit_load(T1, ATTR_BASE_OFFSET, ACC, s);
 
@@ -1474,11 +2729,20 @@ void comp_class::code(ostream &s) {
     emit_label_def(lebalid, s);
 }
 
+void comp_class::code_unboxed(ostream &s) {
+    e1->code_unboxed(s);
+    emit_seq(ACC, ACC, ZERO, s);
+}
+
 void int_const_class::code(ostream& s) {
   IntEntry *int_entry = inttable.lookup_string(token->get_string());
   emit_load_int(ACC, int_entry, s);
 }
 
+void int_const_class::code_unboxed(ostream& s) {
+  emit_load_imm(ACC, atoi(token->get_string()), s);
+}
+
 void string_const_class::code(ostream& s) {
   emit_load_string(ACC,stringtable.lookup_string(token->get_string()),s);
 }
@@ -1487,6 +2751,10 @@ void bool_const_class::code(ostream& s) {
   emit_load_bool(ACC, BoolConst(val), s);
 }
 
+void bool_const_class::code_unboxed(ostream& s) {
+  emit_load_imm(ACC, val, s);
+}
+
 void new__class::code(ostream &s) {
     std::string object_name = type_name->get_string();
     if (type_name == SELF_TYPE) {
@@ -1495,7 +2763,7 @@ void new__class::code(ostream &s) {
         emit_sll(T1, T1, 3, s);
         emit_add(T2, T1, T2, s);
         emit_load(ACC, 0, T2, s);
-        emit_jal("Object.copy", s);
+        emit_gc_jal("Object.copy", s);
 
         emit_load(T1, 0, ACC, s);
         emit_load_address(T2, CLASSOBJTAB, s);
@@ -1505,10 +2773,16 @@ void new__class::code(ostream &s) {
         emit_jalr(A1, s);
     } else {
         std::string protobj_object = object_name + PROTOBJ_SUFFIX;
-        emit_load_address(ACC, const_cast<char *>(protobj_object.c_str()), s);
-        emit_jal("Object.copy", s);
+        int words = codegen_classtable->get_object_size(type_name);
+        if (inline_alloc(words)) {
+            emit_load_address(T2, const_cast<char *>(protobj_object.c_str()), s);
+            emit_alloc_copy(words, words, s);
+        } else {
+            emit_load_address(ACC, const_cast<char *>(protobj_object.c_str()), s);
+            emit_gc_jal("Object.copy", s);
+        }
         std::string init_object = object_name + CLASSINIT_SUFFIX;
-        emit_jal(const_cast<char *>(init_object.c_str()), s);
+        emit_gc_jal(const_cast<char *>(init_object.c_str()), s);
     }
 }
 
@@ -1535,6 +2809,14 @@ void object_class::code(ostream &s) {
     }
     CgenNodeP curr_cgen = codegen_classtable->get_curr_class();
     int offset;
+    const EnvTable::Binding *local = envTable->find(name);
+    if (local && (local->unboxed || local->reg)) {
+        emit_load_local(local, s);
+        if (local->unboxed) {
+            emit_box(get_type(), s);
+        }
+        return;
+    }
     if (envTable->lookup(name, &offset)) {
         emit_load(ACC, offset, FP, s);
         emit_gc_update(FP, offset, s);
@@ -1546,4 +2828,669 @@ void object_class::code(ostream &s) {
     }
 }
 
+void object_class::code_unboxed(ostream &s) {
+    const EnvTable::Binding *local = envTable->find(name);
+    if (local && local->unboxed) {
+        emit_load_local(local, s);
+        return;
+    }
+    Expression_class::code_unboxed(s);
+}
+
+//******************************************************************
+//
+//   alloc_regs walks an expression in the order code() visits it and
+//   opens and closes the live intervals of the values that the
+//   register allocator may keep in a register: let and case variables
+//   for the extent of their bodies, and the left operand of a binary
+//   operator while the right one is coded.
+//
+//*****************************************************************
+
+void assign_class::alloc_regs(RegAllocator &ra) {
+    expr->alloc_regs(ra);
+}
+
+void static_dispatch_class::alloc_regs(RegAllocator &ra) {
+    for (int i = actual->first(); actual->more(i); i = actual->next(i)) {
+        actual->nth(i)->alloc_regs(ra);
+    }
+    expr->alloc_regs(ra);
+}
+
+void dispatch_class::alloc_regs(RegAllocator &ra) {
+    for (int i = actual->first(); actual->more(i); i = actual->next(i)) {
+        actual->nth(i)->alloc_regs(ra);
+    }
+    expr->alloc_regs(ra);
+}
+
+void cond_class::alloc_regs(RegAllocator &ra) {
+    pred->alloc_regs(ra);
+    then_exp->alloc_regs(ra);
+    else_exp->alloc_regs(ra);
+}
+
+void loop_class::alloc_regs(RegAllocator &ra) {
+    pred->alloc_regs(ra);
+    body->alloc_regs(ra);
+}
+
+void typcase_class::alloc_regs(RegAllocator &ra) {
+    expr->alloc_regs(ra);
+    for (int i = cases->first(); cases->more(i); i = cases->next(i)) {
+        Case branch = cases->nth(i);
+        ra.open(branch);
+        branch->get_expr()->alloc_regs(ra);
+        ra.close(branch);
+    }
+}
+
+void block_class::alloc_regs(RegAllocator &ra) {
+    for (int i = body->first(); body->more(i); i = body->next(i)) {
+        body->nth(i)->alloc_regs(ra);
+    }
+}
+
+void let_class::alloc_regs(RegAllocator &ra) {
+    init->alloc_regs(ra);
+    ra.open(this);
+    body->alloc_regs(ra);
+    ra.close(this);
+}
+
+static void alloc_binary_regs(RegAllocator &ra, Expression op, Expression e1, Expression e2) {
+    e1->alloc_regs(ra);
+    ra.open(op);
+    e2->alloc_regs(ra);
+    ra.close(op);
+}
+
+void plus_class::alloc_regs(RegAllocator &ra) {
+    alloc_binary_regs(ra, this, e1, e2);
+}
+
+void sub_class::alloc_regs(RegAllocator &ra) {
+    alloc_binary_regs(ra, this, e1, e2);
+}
+
+void mul_class::alloc_regs(RegAllocator &ra) {
+    alloc_binary_regs(ra, this, e1, e2);
+}
+
+void divide_class::alloc_regs(RegAllocator &ra) {
+    alloc_binary_regs(ra, this, e1, e2);
+}
+
+void neg_class::alloc_regs(RegAllocator &ra) {
+    e1->alloc_regs(ra);
+}
+
+void lt_class::alloc_regs(RegAllocator &ra) {
+    alloc_binary_regs(ra, this, e1, e2);
+}
+
+void eq_class::alloc_regs(RegAllocator &ra) {
+    alloc_binary_regs(ra, this, e1, e2);
+}
+
+void leq_class::alloc_regs(RegAllocator &ra) {
+    alloc_binary_regs(ra, this, e1, e2);
+}
+
+void comp_class::alloc_regs(RegAllocator &ra) {
+    e1->alloc_regs(ra);
+}
+
+void int_const_class::alloc_regs(RegAllocator &ra) {}
+
+void string_const_class::alloc_regs(RegAllocator &ra) {}
+
+void bool_const_class::alloc_regs(RegAllocator &ra) {}
+
+void new__class::alloc_regs(RegAllocator &ra) {}
+
+void isvoid_class::alloc_regs(RegAllocator &ra) {
+    e1->alloc_regs(ra);
+}
+
+void no_expr_class::alloc_regs(RegAllocator &ra) {}
+
+void object_class::alloc_regs(RegAllocator &ra) {}
+
+//******************************************************************
+//
+//   size counts the nodes of an expression, for the inliner's budget
+//   (-i).
+//
+//*****************************************************************
+
+static int size_of(Expressions l) {
+    int n = 0;
+    for (int i = l->first(); l->more(i); i = l->next(i)) {
+        n += l->nth(i)->size();
+    }
+    return n;
+}
+
+int assign_class::size() {
+    return 1 + expr->size();
+}
+
+int static_dispatch_class::size() {
+    return 1 + expr->size() + size_of(actual);
+}
+
+int dispatch_class::size() {
+    return 1 + expr->size() + size_of(actual);
+}
+
+int cond_class::size() {
+    return 1 + pred->size() + then_exp->size() + else_exp->size();
+}
+
+int loop_class::size() {
+    return 1 + pred->size() + body->size();
+}
+
+int typcase_class::size() {
+    int n = 1 + expr->size();
+    for (int i = cases->first(); cases->more(i); i = cases->next(i)) {
+        n += cases->nth(i)->get_expr()->size();
+    }
+    return n;
+}
+
+int block_class::size() {
+    return 1 + size_of(body);
+}
+
+int let_class::size() {
+    return 1 + init->size() + body->size();
+}
+
+int plus_class::size() {
+    return 1 + e1->size() + e2->size();
+}
+
+int sub_class::size() {
+    return 1 + e1->size() + e2->size();
+}
+
+int mul_class::size() {
+    return 1 + e1->size() + e2->size();
+}
+
+int divide_class::size() {
+    return 1 + e1->size() + e2->size();
+}
+
+int neg_class::size() {
+    return 1 + e1->size();
+}
+
+int lt_class::size() {
+    return 1 + e1->size() + e2->size();
+}
+
+int eq_class::size() {
+    return 1 + e1->size() + e2->size();
+}
+
+int leq_class::size() {
+    return 1 + e1->size() + e2->size();
+}
+
+int comp_class::size() {
+    return 1 + e1->size();
+}
+
+int int_const_class::size() { return 1; }
+
+int string_const_class::size() { return 1; }
+
+int bool_const_class::size() { return 1; }
+
+int new__class::size() { return 1; }
+
+int isvoid_class::size() {
+    return 1 + e1->size();
+}
+
+int no_expr_class::size() { return 0; }
+
+int object_class::size() { return 1; }
+
+//******************************************************************
+//
+//   flatten_lists flattens every list of the tree (see list_node in
+//   tree.h) before the classes are coded on several threads (-j),
+//   since flattening allocates from the tree's arena.
+//
+//*****************************************************************
+
+static void flatten_list(Expressions l) {
+    for (int i = l->first(); l->more(i); i = l->next(i)) {
+        l->nth(i)->flatten_lists();
+    }
+}
+
+void class__class::flatten_lists() {
+    for (int i = features->first(); features->more(i); i = features->next(i)) {
+        features->nth(i)->flatten_lists();
+    }
+}
+
+void method_class::flatten_lists() {
+    formals->len();
+    expr->flatten_lists();
+}
+
+void attr_class::flatten_lists() {
+    init->flatten_lists();
+}
+
+void branch_class::flatten_lists() {
+    expr->flatten_lists();
+}
+
+void assign_class::flatten_lists() {
+    expr->flatten_lists();
+}
+
+void static_dispatch_class::flatten_lists() {
+    expr->flatten_lists();
+    flatten_list(actual);
+}
+
+void dispatch_class::flatten_lists() {
+    expr->flatten_lists();
+    flatten_list(actual);
+}
+
+void cond_class::flatten_lists() {
+    pred->flatten_lists();
+    then_exp->flatten_lists();
+    else_exp->flatten_lists();
+}
+
+void loop_class::flatten_lists() {
+    pred->flatten_lists();
+    body->flatten_lists();
+}
+
+void typcase_class::flatten_lists() {
+    expr->flatten_lists();
+    for (int i = cases->first(); cases->more(i); i = cases->next(i)) {
+        cases->nth(i)->flatten_lists();
+    }
+}
+
+void block_class::flatten_lists() {
+    flatten_list(body);
+}
+
+void let_class::flatten_lists() {
+    init->flatten_lists();
+    body->flatten_lists();
+}
+
+void plus_class::flatten_lists() {
+    e1->flatten_lists();
+    e2->flatten_lists();
+}
+
+void sub_class::flatten_lists() {
+    e1->flatten_lists();
+    e2->flatten_lists();
+}
+
+void mul_class::flatten_lists() {
+    e1->flatten_lists();
+    e2->flatten_lists();
+}
+
+void divide_class::flatten_lists() {
+    e1->flatten_lists();
+    e2->flatten_lists();
+}
+
+void lt_class::flatten_lists() {
+    e1->flatten_lists();
+    e2->flatten_lists();
+}
+
+void eq_class::flatten_lists() {
+    e1->flatten_lists();
+    e2->flatten_lists();
+}
+
+void leq_class::flatten_lists() {
+    e1->flatten_lists();
+    e2->flatten_lists();
+}
+
+void neg_class::flatten_lists() {
+    e1->flatten_lists();
+}
+
+void comp_class::flatten_lists() {
+    e1->flatten_lists();
+}
+
+void isvoid_class::flatten_lists() {
+    e1->flatten_lists();
+}
+
+void int_const_class::flatten_lists() {}
+
+void string_const_class::flatten_lists() {}
+
+void bool_const_class::flatten_lists() {}
+
+void new__class::flatten_lists() {}
+
+void no_expr_class::flatten_lists() {}
+
+void object_class::flatten_lists() {}
+
+//******************************************************************
+//
+//   fold replaces the constant parts of a typed expression by their
+//   values before any code is generated, and returns the expression
+//   to code in place of this one.  Arithmetic and comparisons of
+//   constants become int_const and bool_const nodes, String methods
+//   of string constants become constants, and the branches of ifs and
+//   whiles that cannot be taken are dropped.  An operation whose code
+//   would abort at runtime (an overflowing add, a division by zero, a
+//   substr out of range) is left for the runtime to report.  New
+//   literals go in inttable and stringtable so that code_constants
+//   emits them.  Run under -O only.
+//
+//*****************************************************************
+
+static bool int_value(Expression e, int *v) {
+    int_const_class *c = dynamic_cast<int_const_class *>(e);
+    if (!c) return false;
+    *v = atoi(c->token->get_string());
+    return true;
+}
+
+static bool bool_value(Expression e, bool *v) {
+    bool_const_class *c = dynamic_cast<bool_const_class *>(e);
+    if (!c) return false;
+    *v = c->val;
+    return true;
+}
+
+static bool string_value(Expression e, Symbol *v) {
+    string_const_class *c = dynamic_cast<string_const_class *>(e);
+    if (!c) return false;
+    *v = c->token;
+    return true;
+}
+
+static bool is_constant(Expression e) {
+    int i; bool b; Symbol str;
+    return int_value(e, &i) || bool_value(e, &b) || string_value(e, &str);
+}
+
+// the new node takes the line number of the expression it replaces
+static Expression fold_int(Expression at, long long v) {
+    node_lineno = at->get_line_number();
+    return int_const(inttable.add_int((int) v))->set_type(Int);
+}
+
+static Expression fold_bool(Expression at, bool v) {
+    node_lineno = at->get_line_number();
+    return bool_const(v)->set_type(Bool);
+}
+
+static Expression fold_string(Expression at, char *v) {
+    node_lineno = at->get_line_number();
+    return string_const(stringtable.add_string(v))->set_type(Str);
+}
+
+static Expressions fold_list(Expressions l) {
+    Expressions folded = nil_Expressions();
+    bool changed = false;
+    for (int i = l->first(); l->more(i); i = l->next(i)) {
+        Expression e = l->nth(i)->fold();
+        changed = changed || e != l->nth(i);
+        folded = append_Expressions(folded, single_Expressions(e));
+    }
+    return changed ? folded : l;
+}
+
+void program_class::fold() {
+    for (int i = classes->first(); classes->more(i); i = classes->next(i)) {
+        Features fs = classes->nth(i)->get_features();
+        for (int j = fs->first(); fs->more(j); j = fs->next(j)) {
+            Feature f = fs->nth(j);
+            if (f->is_method()) {
+                method_class *m = static_cast<method_class *>(f);
+                m->expr = m->expr->fold();
+            } else {
+                attr_class *a = static_cast<attr_class *>(f);
+                a->init = a->init->fold();
+            }
+        }
+    }
+}
+
+Expression assign_class::fold() {
+    expr = expr->fold();
+    return this;
+}
+
+Expression static_dispatch_class::fold() {
+    expr = expr->fold();
+    actual = fold_list(actual);
+    return this;
+}
+
+//
+// String has no subclasses, so a method of a String constant is
+// always String's own.
+//
+Expression dispatch_class::fold() {
+    expr = expr->fold();
+    actual = fold_list(actual);
+
+    Symbol str, arg;
+    int i, l;
+    if (!string_value(expr, &str)) return this;
+    if (name == length && actual->len() == 0) {
+        return fold_int(this, str->get_len());
+    }
+    if (name == concat && actual->len() == 1 && string_value(actual->nth(0), &arg)) {
+        std::string v = std::string(str->get_string()) + arg->get_string();
+        return fold_string(this, (char *) v.c_str());
+    }
+    if (name == substr && actual->len() == 2
+        && int_value(actual->nth(0), &i) && int_value(actual->nth(1), &l)
+        && i >= 0 && l >= 0 && (long long) i + l <= str->get_len()) {
+        std::string v(str->get_string() + i, l);
+        return fold_string(this, (char *) v.c_str());
+    }
+    return this;
+}
+
+//
+// A branch replaces the if only if it has the if's type, since the
+// code for the expression around it may depend on that type.
+//
+Expression cond_class::fold() {
+    pred = pred->fold();
+    then_exp = then_exp->fold();
+    else_exp = else_exp->fold();
+
+    bool b;
+    if (bool_value(pred, &b)) {
+        Expression taken = b ? then_exp : else_exp;
+        if (taken->get_type() == get_type()) return taken;
+    }
+    return this;
+}
+
+Expression loop_class::fold() {
+    pred = pred->fold();
+    body = body->fold();
+
+    bool b;
+    if (bool_value(pred, &b) && !b) {
+        node_lineno = get_line_number();
+        return no_expr()->set_type(get_type());
+    }
+    return this;
+}
+
+Expression typcase_class::fold() {
+    expr = expr->fold();
+    for (int i = cases->first(); cases->more(i); i = cases->next(i)) {
+        branch_class *branch = static_cast<branch_class *>(cases->nth(i));
+        branch->expr = branch->expr->fold();
+    }
+    return this;
+}
+
+// constants before the last expression have no effect
+Expression block_class::fold() {
+    body = fold_list(body);
+    Expressions kept = nil_Expressions();
+    int n = body->len();
+    for (int i = 0; i < n - 1; i++) {
+        if (!is_constant(body->nth(i)))
+            kept = append_Expressions(kept, single_Expressions(body->nth(i)));
+    }
+    if (kept->len() == n - 1) return this;
+    body = append_Expressions(kept, single_Expressions(body->nth(n - 1)));
+    return this;
+}
+
+Expression let_class::fold() {
+    init = init->fold();
+    body = body->fold();
+    return this;
+}
+
+Expression plus_class::fold() {
+    e1 = e1->fold();
+    e2 = e2->fold();
+    int x, y;
+    if (int_value(e1, &x) && int_value(e2, &y)) {
+        long long r = (long long) x + y;
+        if (r >= INT_MIN && r <= INT_MAX) return fold_int(this, r);
+    }
+    return this;
+}
+
+Expression sub_class::fold() {
+    e1 = e1->fold();
+    e2 = e2->fold();
+    int x, y;
+    if (int_value(e1, &x) && int_value(e2, &y)) {
+        long long r = (long long) x - y;
+        if (r >= INT_MIN && r <= INT_MAX) return fold_int(this, r);
+    }
+    return this;
+}
+
+// mul does not trap on overflow; the product wraps
+Expression mul_class::fold() {
+    e1 = e1->fold();
+    e2 = e2->fold();
+    int x, y;
+    if (int_value(e1, &x) && int_value(e2, &y)) {
+        return fold_int(this, (int) ((unsigned) x * (unsigned) y));
+    }
+    return this;
+}
+
+Expression divide_class::fold() {
+    e1 = e1->fold();
+    e2 = e2->fold();
+    int x, y;
+    if (int_value(e1, &x) && int_value(e2, &y)
+        && y != 0 && !(x == INT_MIN && y == -1)) {
+        return fold_int(this, x / y);
+    }
+    return this;
+}
+
+Expression neg_class::fold() {
+    e1 = e1->fold();
+    int x;
+    if (int_value(e1, &x) && x != INT_MIN) {
+        return fold_int(this, -x);
+    }
+    return this;
+}
+
+Expression lt_class::fold() {
+    e1 = e1->fold();
+    e2 = e2->fold();
+    int x, y;
+    if (int_value(e1, &x) && int_value(e2, &y)) {
+        return fold_bool(this, x < y);
+    }
+    return this;
+}
+
+Expression eq_class::fold() {
+    e1 = e1->fold();
+    e2 = e2->fold();
+    int x, y;
+    bool a, b;
+    Symbol s, t;
+    if (int_value(e1, &x) && int_value(e2, &y)) {
+        return fold_bool(this, x == y);
+    }
+    if (bool_value(e1, &a) && bool_value(e2, &b)) {
+        return fold_bool(this, a == b);
+    }
+    // stringtable holds one entry per distinct string
+    if (string_value(e1, &s) && string_value(e2, &t)) {
+        return fold_bool(this, s == t);
+    }
+    return this;
+}
+
+Expression leq_class::fold() {
+    e1 = e1->fold();
+    e2 = e2->fold();
+    int x, y;
+    if (int_value(e1, &x) && int_value(e2, &y)) {
+        return fold_bool(this, x <= y);
+    }
+    return this;
+}
+
+Expression comp_class::fold() {
+    e1 = e1->fold();
+    bool b;
+    if (bool_value(e1, &b)) {
+        return fold_bool(this, !b);
+    }
+    return this;
+}
+
+Expression int_const_class::fold() { return this; }
+
+Expression string_const_class::fold() { return this; }
+
+Expression bool_const_class::fold() { return this; }
+
+Expression new__class::fold() { return this; }
+
+Expression isvoid_class::fold() {
+    e1 = e1->fold();
+    if (is_constant(e1)) {
+        return fold_bool(this, false);
+    }
+    return this;
+}
+
+Expression no_expr_class::fold() { return this; }
 
+Expression object_class::fold() { return this; }
@@ -1,5 +1,6 @@
 #include <assert.h>
 #include <stdio.h>
+#include <string.h>
 #include "emit.h"
 #include "cool-tree.h"
 #include "symtab.h"
@@ -8,6 +9,10 @@
 #include <functional>
 #include <algorithm>
 #include <list>
+#include <deque>
+#include <unordered_map>
+#include <sstream>
+#include "cgen_ir.h"
 
 enum Basicness     {Basic, NotBasic};
 #define ATTR_BASE_OFFSET 3
@@ -21,6 +26,47 @@ typedef CgenClassTable *CgenClassTableP;
 class CgenNode;
 typedef CgenNode *CgenNodeP;
 
+//
+// The stack map of a call that may collect garbage (see code_stack_maps).
+// It describes the frame of the routine making the call: which words of
+// the frame, and which of the registers the routine has allocated, hold
+// pointers into the heap while the call runs.
+//
+struct StackMap {
+    int depth;              // words in use below $fp, saved registers too
+    int args;               // argument words above the frame
+    int pushed;             // argument words pushed below a fixed frame
+                            // (-O), until place_frame counts them in
+    int regs;               // $s1-$s6 holding pointers, as a REG mask
+    int saves;              // 4 bits per register from $s1: its save slot
+    std::vector<int> slots; // $fp offsets in words of the pointers
+};
+
+//
+// A class's _init routine, or its methods, coded as one unit of work.
+// Units are coded independently, on as many threads as -j asks for, and
+// each numbers its labels, stack maps and jump tables from 0.  When the
+// units are written out in order, place_unit shifts each one's numbers
+// past those of the units before it, so the output is the same whatever
+// the number of threads.
+//
+struct CgenUnit {
+    CgenNodeP cls;
+    bool init;                   // the _init routine, not the methods
+    std::ostringstream text;
+    int labels = 0;
+    std::vector<StackMap> stack_maps;
+    std::map<int, std::vector<int>> case_tables;
+    IRRoutineInfo routine;       // of the routine being coded
+    int dispatch_cnt = 0;
+    int devirtualized_cnt = 0;
+    method_class *method = nullptr;   // the method being coded, if any
+    // the methods being coded in place of calls (see code_inline),
+    // innermost last, each with the class of its self
+    std::vector<std::pair<method_class*, CgenNodeP>> inlined;
+    int inlined_cnt = 0;
+};
+
 class CgenClassTable : public SymbolTable<Symbol,CgenNode> {
 private:
    List<CgenNode> *nds;
@@ -28,17 +74,44 @@ private:
    int stringclasstag;
    int intclasstag;
    int boolclasstag;
-   int labelid_;
-   CgenNodeP curr_cgenclass_;
+   int placed_labels_;   // labels of the units written out so far
 
-   std::map<int, Symbol> class_tag_map_;
-   std::map<Symbol, CgenNodeP> name_to_cgen_map_;
-   std::map<Symbol, std::vector<attr_class*>> class_attr_map_;
-   std::map<Symbol, std::vector<method_class*>> class_method_map_;
-   std::map<Symbol, std::map<Symbol, int>> attr_offset_map_;
-   std::map<Symbol, std::map<Symbol, int>> meth_offset_map_;
-   std::map<Symbol, std::vector<std::pair<Symbol, Symbol>>> dispatch_tab_map_;
-   std::map<Symbol, std::vector<CgenNodeP>> parent_chain_map_;
+   //
+   // The layout of each class, at its tag.  install_attrs_and_methods
+   // fills the layouts in tag order, which puts every class after its
+   // parent, so each starts from a copy of its parent's attributes and
+   // dispatch table.
+   //
+   struct ClassLayout {
+       std::vector<attr_class*> own_attrs;
+       std::vector<method_class*> own_methods;
+       // every attribute, Object's first; attrs[i] is at word
+       // ATTR_BASE_OFFSET + i of an object
+       std::vector<attr_class*> attrs;
+       std::unordered_map<Symbol, int> attr_offsets;
+       // the class and method whose code is in each slot of the table
+       std::vector<std::pair<Symbol, Symbol>> disptab;
+       std::unordered_map<Symbol, int> meth_offsets;
+       // method -> the one implementation any object of the class (or
+       // a subclass) can run, for methods no subclass overrides
+       std::unordered_map<Symbol, Symbol> monomorphic;
+       // neither the class nor an ancestor initializes an attribute, so
+       // its _init routine does nothing
+       bool no_inits = true;
+   };
+   std::vector<CgenNodeP> class_by_tag_;
+   std::vector<ClassLayout> layouts_;
+   std::unordered_map<Symbol, CgenNodeP> name_to_cgen_map_;
+   const ClassLayout *get_layout(Symbol cls);   // NULL if cls is no class
+   int dispatch_cnt_;
+   int devirtualized_cnt_;
+   int inlined_cnt_;
+   std::vector<StackMap> stack_maps_;   // of all the units, in order
+   std::vector<int> placed_maps_;   // the maps left in the code, in order
+   // the label of each class tag's branch, from the lowest tag, for each
+   // case coded with a jump table, and the tables left in the code
+   std::map<int, std::vector<int>> case_tables_;
+   std::vector<int> placed_case_tables_;
 
 
 
@@ -54,8 +127,12 @@ private:
    void code_class_objtabs();
    void code_object_disptabs();
    void code_protobjs();
-   void code_object_inits();
-   void code_methods();
+   void code_object_init(CgenUnit &u);
+   void code_methods(CgenUnit &u);
+   void code_units(std::vector<CgenUnit> &units);
+   void place_unit(const CgenUnit &u, ostream &s);
+   void code_stack_maps();
+   void code_case_tables();
 
 // The following creates an inheritance graph from
 // a list of classes.  The graph is implemented as
@@ -70,49 +147,125 @@ private:
    void install_name_to_cgen();
    void install_classtags();
    void install_attrs_and_methods();
+   void install_monomorphic_methods();
 public:
    CgenClassTable(Classes, ostream& str);
    void code();
    CgenNodeP root();
-   CgenNodeP get_cgennode(Symbol name) { return name_to_cgen_map_[name]; }
-   CgenNodeP get_curr_class() const { return curr_cgenclass_; }
-   int get_labelid_and_add() { return labelid_++; }
+   CgenNodeP get_cgennode(Symbol name);
    bool get_attr_offset(Symbol cls, Symbol attr, int *offset);
-   bool get_meth_offset(Symbol cls1, Symbol cls2, Symbol meth, int *offset);
+   int get_object_size(Symbol cls);   // in words
    bool get_meth_offset(Symbol cls, Symbol meth, int *offset);
+   bool get_monomorphic_impl(Symbol cls, Symbol meth, Symbol *impl);
+   // the class whose method meth an object of exactly class cls runs
+   bool get_exact_impl(Symbol cls, Symbol meth, Symbol *impl);
+   method_class *get_method(Symbol cls, Symbol meth);   // cls's own
+   // these go to the unit being coded on the calling thread
+   CgenNodeP get_curr_class() const;
+   int get_labelid_and_add();
+   void count_dispatch(bool devirtualized);
+   bool can_inline(method_class *meth) const;
+   void enter_inline(method_class *meth, CgenNodeP cls);
+   void exit_inline();
+   int add_stack_map(const StackMap &map);
+   void add_case_table(int id, const std::vector<int> &labels);
 };
 
 
 class EnvTable {
 public:
-    typedef std::list<std::pair<Symbol, int>> symbol2offsetList;
+    struct Binding {
+        Symbol name;
+        int offset;
+        bool unboxed;   // the slot holds a raw Int/Bool value (-O)
+        char *reg;      // register holding the value, or NULL for the slot
+    };
+    // what a slot below $fp holds, for the stack maps
+    enum SlotKind { POINTER_SLOT, RAW_SLOT, SAVED_SLOT };
 private:
-    std::list<symbol2offsetList> envlist_;
+    // the bindings of all the open scopes, innermost last; a deque, so
+    // a Binding found stays put while inner scopes come and go
+    std::deque<Binding> bindings_;
+    std::vector<int> scope_starts_;    // where each open scope begins in bindings_
+    std::vector<int> scope_fp_offsets_;  // local_fp_offset_ on entry to each scope
+    // each name's bindings in bindings_, innermost last
+    std::unordered_map<Symbol, std::vector<int>> index_;
+    // bindings_ below this are hidden from find, in an inlined method's
+    // scope; and its value on entry to each scope
+    int hidden_ = 0;
+    std::vector<int> scope_hidden_;
+    std::vector<SlotKind> slots_;      // slots_[i] is the slot at -(i+1)($fp)
     int formal_fp_offset_;
     int local_fp_offset_;
-    int last_local_fp_offset_;
+    //
+    // In a fixed frame (-O) all the slots the routine ever has in use at
+    // once are reserved by emit_start_frame, and the arguments of a call
+    // are pushed below them instead of taking slots.
+    //
+    bool fixed_ = false;
+    int max_slots_ = 0;
+    int args_ = 0;
 
     void init_formal_fpoffset() {
         formal_fp_offset_ = DEFAULT_OBJFIELDS;
     }
     void init_local_fpoffset() {
         local_fp_offset_ = -1;
-        last_local_fp_offset_ = -1;
+        slots_.clear();
+        max_slots_ = 0;
+        args_ = 0;
+    }
+    void grow() {
+        max_slots_ = std::max(max_slots_, (int) slots_.size());
     }
 public:
     EnvTable() = default;
     ~EnvTable() = default;
-    void enterframe();
+    void enterframe(bool fixed = false);
     void exitframe();
-    void enterscope();
+    void enterscope(bool hide_outer = false);
     void exitscope();
 
-    void add_formal_id(Symbol name);
-    void add_local_id(Symbol name);
-    bool lookup(Symbol name, int *offset);
+    void add_formal_id(Symbol name, char *reg = nullptr);
+    void add_local_id(Symbol name, bool unboxed = false, char *reg = nullptr);
+    // a name for a slot already taken with push_temp
+    void add_slot_id(Symbol name, int offset) {
+        index_[name].push_back(bindings_.size());
+        bindings_.push_back({name, offset, false, nullptr});
+    }
+    // a temporary kept by the code takes a slot below the locals
+    void push_temp(int n = 1, SlotKind kind = POINTER_SLOT) {
+        local_fp_offset_ -= n;
+        slots_.insert(slots_.end(), n, kind);
+        grow();
+    }
+    void pop_temp(int n = 1) {
+        local_fp_offset_ += n;
+        slots_.resize(slots_.size() - n);
+    }
+    // an argument pushed for a call
+    void push_arg() {
+        if (fixed_) args_++; else push_temp();
+    }
+    void pop_args(int n) {
+        if (fixed_) args_ -= n; else pop_temp(n);
+    }
+    bool fixed_frame() const { return fixed_; }
+    // the $fp offset of the next slot taken, or of the one just given back
+    int next_slot() const { return local_fp_offset_; }
+    // the words emit_start_frame reserves for the slots
+    int frame_words() const { return fixed_ ? max_slots_ : 0; }
+    // a temporary kept in a register, until the scope is left
+    void hold_reg(char *reg, bool unboxed) {
+        bindings_.push_back({nullptr, 0, unboxed, reg});
+    }
+    const Binding *find(Symbol name);
+    bool lookup(Symbol name, int *offset, bool *unboxed = nullptr);
+    void stack_map(StackMap &map);
 };
 
-void EnvTable::enterframe() {
+void EnvTable::enterframe(bool fixed) {
+    fixed_ = fixed;
     init_formal_fpoffset();
     init_local_fpoffset();
     enterscope();
@@ -124,35 +277,192 @@ void EnvTable::exitframe() {
     init_local_fpoffset();
 }
 
-void EnvTable::enterscope() {
-    last_local_fp_offset_ = local_fp_offset_;
-    envlist_.push_back({});
+void EnvTable::enterscope(bool hide_outer) {
+    scope_fp_offsets_.push_back(local_fp_offset_);
+    scope_starts_.push_back(bindings_.size());
+    scope_hidden_.push_back(hidden_);
+    if (hide_outer) {
+        hidden_ = bindings_.size();
+    }
 }
 
 void EnvTable::exitscope() {
-    envlist_.pop_back();
-    local_fp_offset_ = last_local_fp_offset_;
+    while ((int) bindings_.size() > scope_starts_.back()) {
+        if (bindings_.back().name) {
+            index_[bindings_.back().name].pop_back();
+        }
+        bindings_.pop_back();
+    }
+    scope_starts_.pop_back();
+    hidden_ = scope_hidden_.back();
+    scope_hidden_.pop_back();
+    local_fp_offset_ = scope_fp_offsets_.back();
+    scope_fp_offsets_.pop_back();
+    slots_.resize(-local_fp_offset_ - 1);
+}
+
+void EnvTable::add_formal_id(Symbol name, char *reg) {
+    index_[name].push_back(bindings_.size());
+    bindings_.push_back({name, formal_fp_offset_++, false, reg});
+}
+
+// a local kept in a register has no stack slot
+void EnvTable::add_local_id(Symbol name, bool unboxed, char *reg) {
+    index_[name].push_back(bindings_.size());
+    bindings_.push_back({name, reg ? 0 : local_fp_offset_--, unboxed, reg});
+    if (!reg) {
+        slots_.push_back(unboxed ? RAW_SLOT : POINTER_SLOT);
+        grow();
+    }
 }
 
-void EnvTable::add_formal_id(Symbol name) {
-    envlist_.back().push_back({name, formal_fp_offset_++});
+const EnvTable::Binding *EnvTable::find(Symbol name) {
+    auto it = index_.find(name);
+    if (it == index_.end() || it->second.empty() || it->second.back() < hidden_) {
+        return nullptr;
+    }
+    return &bindings_[it->second.back()];
 }
 
-void EnvTable::add_local_id(Symbol name) {
-    envlist_.back().push_back({name, local_fp_offset_--});
+bool EnvTable::lookup(Symbol name, int *offset, bool *unboxed) {
+    const Binding *b = find(name);
+    if (b == nullptr) {
+        return false;
+    }
+    *offset = b->offset;
+    if (unboxed) *unboxed = b->unboxed;
+    return true;
 }
 
-bool EnvTable::lookup(Symbol name, int *offset) {
-    for (auto rit = envlist_.rbegin(); rit != envlist_.rend(); ++rit) {
-        const symbol2offsetList &sym2off_list = *rit;
-        for (auto rlit = sym2off_list.rbegin(); rlit != sym2off_list.rend(); ++rlit) {
-            if (rlit->first == name) {
-                *offset = rlit->second;
-                return true;
+//
+// The frame as it is now: the slots and formals holding pointers, and
+// the registers holding pointers.  A formal kept in a register is read
+// from the register only, so its slot is left out.  The depth of a fixed
+// frame is not known yet; only the arguments pushed below it are.
+//
+void EnvTable::stack_map(StackMap &map) {
+    static char *regs[] = { S1, S2, S3, S4, S5, S6 };
+    map.depth = fixed_ ? 0 : slots_.size();
+    map.pushed = fixed_ ? args_ : 0;
+    map.args = formal_fp_offset_ - DEFAULT_OBJFIELDS;
+    map.regs = 0;
+    map.slots.clear();
+    for (int i = 0; i < (int) slots_.size(); i++) {
+        if (slots_[i] == POINTER_SLOT) {
+            map.slots.push_back(-1 - i);
+        }
+    }
+    for (auto &b : bindings_) {
+        if (b.reg) {
+            for (int i = 0; i < 6; i++) {
+                if (strcmp(b.reg, regs[i]) == 0 && !b.unboxed) {
+                    map.regs |= 1 << (17 + i);
+                }
             }
+        } else if (b.offset > 0) {
+            map.slots.push_back(b.offset);
         }
     }
-    return false;
+}
+
+//
+// Linear-scan register allocation (-O, unless -r).
+//
+// Before a method or a class's _init routine is coded, a walk of its
+// tree (alloc_regs) gives a live interval to each formal, each let and
+// case variable, and each temporary holding the left operand of a binary
+// operator.  An interval opens where the value is bound and closes at
+// the end of its scope.  allocate() then gives every interval one of the
+// callee-saved registers $s1-$s6 for its whole lifetime, or leaves it on
+// the stack; when the registers run out, the interval that ends last is
+// the one spilled.
+//
+class RegAllocator {
+private:
+    struct Interval {
+        tree_node *key;
+        int start;
+        int end;
+        char *reg;
+    };
+    std::vector<Interval> intervals_;
+    std::map<tree_node*, int> index_;
+    std::vector<char*> used_regs_;
+    int pos_;
+public:
+    RegAllocator() : pos_(0) {}
+    void clear();
+    void open(tree_node *key);
+    void close(tree_node *key);
+    void allocate();
+    char *reg(tree_node *key);   // NULL if key stays on the stack
+    const std::vector<char*> &used_regs() const { return used_regs_; }
+};
+
+void RegAllocator::clear() {
+    intervals_.clear();
+    index_.clear();
+    used_regs_.clear();
+    pos_ = 0;
+}
+
+void RegAllocator::open(tree_node *key) {
+    index_[key] = intervals_.size();
+    intervals_.push_back({key, pos_++, -1, nullptr});
+}
+
+void RegAllocator::close(tree_node *key) {
+    intervals_[index_[key]].end = pos_++;
+}
+
+void RegAllocator::allocate() {
+    static char *regs[] = { S1, S2, S3, S4, S5, S6 };
+    const int nregs = sizeof(regs) / sizeof(regs[0]);
+    std::vector<char*> free_regs(regs, regs + nregs);
+    std::reverse(free_regs.begin(), free_regs.end());
+    std::list<Interval*> active;
+
+    // intervals_ is already ordered by start
+    for (auto &curr : intervals_) {
+        for (auto it = active.begin(); it != active.end(); ) {
+            if ((*it)->end < curr.start) {
+                free_regs.push_back((*it)->reg);
+                it = active.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        if (!free_regs.empty()) {
+            curr.reg = free_regs.back();
+            free_regs.pop_back();
+            active.push_back(&curr);
+            continue;
+        }
+        auto last = std::max_element(active.begin(), active.end(),
+            [](Interval *a, Interval *b) { return a->end < b->end; });
+        if ((*last)->end > curr.end) {
+            curr.reg = (*last)->reg;
+            (*last)->reg = nullptr;
+            active.erase(last);
+            active.push_back(&curr);
+        }
+    }
+    for (int i = 0; i < nregs; i++) {
+        for (auto &interval : intervals_) {
+            if (interval.reg == regs[i]) {
+                used_regs_.push_back(regs[i]);
+                break;
+            }
+        }
+    }
+}
+
+char *RegAllocator::reg(tree_node *key) {
+    auto it = index_.find(key);
+    if (it == index_.end()) {
+        return nullptr;
+    }
+    return intervals_[it->second].reg;
 }
 
 class CgenNode : public class__class {
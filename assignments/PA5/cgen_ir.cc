@@ -0,0 +1,952 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  cgen_ir.cc
+//
+//  The intermediate form of a routine and the passes that run on it
+//  under -O (see cgen_ir.h):
+//
+//    fold    constant folding: instructions and branches whose operands
+//            are known constants become li, b, or nothing
+//    copy    copy propagation: uses of the target of a move read its
+//            source instead
+//    dce     dead code elimination: instructions without side effects
+//            whose result is not live are removed
+//    branch  branch simplification: jumps to jumps are threaded,
+//            branches to the next block and unreachable blocks removed,
+//            and blocks the other passes left with only labels joined
+//            to the next
+//    peep    peephole optimization: short runs of adjacent instructions
+//            the emit_ helpers leave behind (a push and a pop, a load of
+//            a slot just stored, two adjustments of one register) are
+//            replaced by fewer
+//
+//  Folding, copy propagation and the peephole pass work within a block;
+//  dead code elimination uses liveness over the whole control flow
+//  graph.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include "cgen_ir.h"
+#include <sstream>
+#include <map>
+#include <stdlib.h>
+#include <limits.h>
+#include <algorithm>
+#include <atomic>
+#include <assert.h>
+
+extern bool disable_const_fold;
+extern bool disable_copy_prop;
+extern bool disable_dce;
+extern bool disable_branch_simp;
+extern bool disable_peephole;
+
+//
+// Registers and the conventions of the code generator and the runtime.
+// A method or _init routine reads self in $a0 and its arguments from the
+// stack; the runtime routines below also read $a1, $t1 or $t2.  A call
+// clobbers every register the callee need not save, including $gp and
+// $s7, which the allocator moves.
+//
+static const char *call_uses[] = { "$a0", "$sp", "$fp", "$gp", "$s0", "$s7" };
+static const struct { const char *routine; const char *regs[4]; } runtime_uses[] = {
+  { "equality_test",   { "$a1", "$t1", "$t2" } },
+  { "_dispatch_abort", { "$t1" } },
+  { "_case_abort2",    { "$t1" } },
+  { "_GenGC_Assign",   { "$a1" } },
+  { "_gc_check",       { "$a1" } },
+};
+// a call with a stack map: the collector may read and update these
+static const char *map_uses[] = { "$s1", "$s2", "$s3", "$s4", "$s5", "$s6" };
+static const char *call_defs[] =
+  { "$a0", "$a1", "$a2", "$a3", "$v0", "$v1", "$at",
+    "$t0", "$t1", "$t2", "$t3", "$t4", "$t5", "$t6", "$t7", "$t8", "$t9",
+    "$ra", "$gp", "$s7" };
+static const char *return_uses[] =
+  { "$a0", "$sp", "$fp", "$ra", "$gp",
+    "$s0", "$s1", "$s2", "$s3", "$s4", "$s5", "$s6", "$s7" };
+// never dead: the stack, the heap and the return address
+static const char *always_live[] = { "$sp", "$fp", "$gp", "$s7", "$ra" };
+
+#define NELEMS(a) (sizeof(a) / sizeof(a[0]))
+
+static bool is_reg(const std::string &s)
+{
+  return !s.empty() && s[0] == '$';
+}
+
+static bool parse_int(const std::string &s, int *val)
+{
+  if (s.empty()) return false;
+  char *end;
+  long v = strtol(s.c_str(), &end, 10);
+  if (*end != '\0' || v < INT_MIN || v > INT_MAX) return false;
+  *val = (int) v;
+  return true;
+}
+
+static void all_regs(std::set<std::string> &regs)
+{
+  static const char *names[] =
+    { "$at", "$v0", "$v1", "$a0", "$a1", "$a2", "$a3",
+      "$t0", "$t1", "$t2", "$t3", "$t4", "$t5", "$t6", "$t7",
+      "$s0", "$s1", "$s2", "$s3", "$s4", "$s5", "$s6", "$s7",
+      "$t8", "$t9", "$gp", "$sp", "$fp", "$ra" };
+  regs.insert(names, names + NELEMS(names));
+}
+
+///////////////////////////////////////////////////////////////////////
+//
+// IRInstr
+//
+///////////////////////////////////////////////////////////////////////
+
+static const std::set<std::string> binary_ops =
+  { "add", "addu", "sub", "subu", "mul", "div", "rem", "and", "or", "xor",
+    "slt", "sle", "seq", "sne", "sgt", "sge" };
+static const std::set<std::string> binary_imm_ops =
+  { "addi", "addiu", "andi", "ori", "slti", "sll", "srl", "sra" };
+static const std::set<std::string> branch_ops =
+  { "beq", "bne", "blt", "ble", "bgt", "bge" };
+static const std::set<std::string> branchz_ops =
+  { "beqz", "bnez", "bltz", "blez", "bgtz", "bgez" };
+
+// "off(base)"
+static bool parse_mem(const std::string &s, int *off, std::string *base)
+{
+  size_t open = s.find('(');
+  if (open == std::string::npos || s.back() != ')') return false;
+  *base = s.substr(open + 1, s.size() - open - 2);
+  return parse_int(s.substr(0, open), off) && is_reg(*base);
+}
+
+IRInstr IRInstr::parse(const std::string &line)
+{
+  IRInstr in;
+  in.kind = IR_OPAQUE;
+  in.imm = 0;
+  in.src2_imm = false;
+  in.text = line;
+  in.changed = false;
+  in.stack_map = false;
+
+  std::istringstream words(line);
+  std::vector<std::string> a;
+  std::string w;
+  while (words >> w && w[0] != '#') a.push_back(w);
+  if (a.empty()) return in;
+
+  if (line[0] != '\t') {
+    if (a.size() == 1 && a[0].back() == ':') {
+      in.kind = IR_LABEL;
+      in.target = a[0].substr(0, a[0].size() - 1);
+    }
+    return in;
+  }
+
+  std::string op = a[0];
+  size_t n = a.size() - 1;
+  if (op == "li" && n == 2 && is_reg(a[1]) && parse_int(a[2], &in.imm)) {
+    in.kind = IR_LI;
+    in.dst = a[1];
+  } else if (op == "la" && n == 2 && is_reg(a[1])) {
+    in.kind = IR_LA;
+    in.dst = a[1];
+    in.target = a[2];
+  } else if ((op == "move" || op == "neg" || op == "not") && n == 2
+             && is_reg(a[1]) && is_reg(a[2])) {
+    in.kind = op == "move" ? IR_MOVE : IR_UNARY;
+    in.dst = a[1];
+    in.src1 = a[2];
+  } else if (binary_ops.count(op) && n == 3 && is_reg(a[1]) && is_reg(a[2])) {
+    in.kind = IR_BINARY;
+    in.dst = a[1];
+    in.src1 = a[2];
+    if (is_reg(a[3])) {
+      in.src2 = a[3];
+    } else if (parse_int(a[3], &in.imm)) {
+      in.src2_imm = true;
+    } else {
+      in.kind = IR_OPAQUE;
+    }
+  } else if (binary_imm_ops.count(op) && n == 3 && is_reg(a[1]) && is_reg(a[2])
+             && parse_int(a[3], &in.imm)) {
+    in.kind = IR_BINARY;
+    in.dst = a[1];
+    in.src1 = a[2];
+    in.src2_imm = true;
+  } else if (op == "lw" && n == 2 && is_reg(a[1]) && parse_mem(a[2], &in.imm, &in.src1)) {
+    in.kind = IR_LOAD;
+    in.dst = a[1];
+  } else if (op == "sw" && n == 2 && is_reg(a[1]) && parse_mem(a[2], &in.imm, &in.src2)) {
+    in.kind = IR_STORE;
+    in.src1 = a[1];
+  } else if (branch_ops.count(op) && n == 3 && is_reg(a[1])) {
+    in.kind = IR_BRANCH;
+    in.src1 = a[1];
+    in.target = a[3];
+    if (is_reg(a[2])) {
+      in.src2 = a[2];
+    } else if (parse_int(a[2], &in.imm)) {
+      in.src2_imm = true;
+    } else {
+      in.kind = IR_OPAQUE;
+    }
+  } else if (branchz_ops.count(op) && n == 2 && is_reg(a[1])) {
+    in.kind = IR_BRANCHZ;
+    in.src1 = a[1];
+    in.target = a[2];
+  } else if ((op == "b" || op == "j") && n == 1) {
+    in.kind = IR_JUMP;
+    in.target = a[1];
+  } else if (op == "jal" && n == 1) {
+    in.kind = IR_CALL;
+    in.target = a[1];
+  } else if (op == "jalr" && n == 1 && is_reg(a[1])) {
+    in.kind = IR_CALL;
+    in.src1 = a[1];
+  } else if (op == "jr" && n == 1 && a[1] == "$ra") {
+    in.kind = IR_RETURN;
+  } else if (op == "jr" && n == 1 && is_reg(a[1])) {
+    in.kind = IR_SWITCH;
+    in.src1 = a[1];
+  }
+  if (in.kind != IR_OPAQUE) in.op = op;
+  return in;
+}
+
+void IRInstr::set_li(const std::string &reg, int val)
+{
+  kind = IR_LI;
+  op = "li";
+  dst = reg;
+  src1 = src2 = target = "";
+  src2_imm = false;
+  imm = val;
+  changed = true;
+}
+
+void IRInstr::set_move(const std::string &to, const std::string &from)
+{
+  kind = IR_MOVE;
+  op = "move";
+  dst = to;
+  src1 = from;
+  src2 = target = "";
+  src2_imm = false;
+  imm = 0;
+  changed = true;
+}
+
+void IRInstr::set_jump(const std::string &label)
+{
+  kind = IR_JUMP;
+  op = "b";
+  dst = src1 = src2 = "";
+  src2_imm = false;
+  target = label;
+  changed = true;
+}
+
+void IRInstr::uses(std::set<std::string> &regs) const
+{
+  switch (kind) {
+  case IR_OPAQUE:
+    all_regs(regs);
+    break;
+  case IR_CALL:
+    regs.insert(call_uses, call_uses + NELEMS(call_uses));
+    if (stack_map) regs.insert(map_uses, map_uses + NELEMS(map_uses));
+    if (!src1.empty()) regs.insert(src1);
+    for (auto &r : runtime_uses) {
+      if (target == r.routine) {
+        for (auto reg : r.regs) {
+          if (reg) regs.insert(reg);
+        }
+      }
+    }
+    break;
+  case IR_RETURN:
+    regs.insert(return_uses, return_uses + NELEMS(return_uses));
+    break;
+  default:
+    if (!src1.empty()) regs.insert(src1);
+    if (!src2.empty()) regs.insert(src2);
+    break;
+  }
+  regs.erase("$zero");
+}
+
+void IRInstr::defs(std::set<std::string> &regs) const
+{
+  if (kind == IR_OPAQUE) {
+    all_regs(regs);
+  } else if (kind == IR_CALL) {
+    regs.insert(call_defs, call_defs + NELEMS(call_defs));
+  } else if (!dst.empty()) {
+    regs.insert(dst);
+  }
+}
+
+// div traps on a zero divisor, so it stays even when its result is dead
+bool IRInstr::is_pure() const
+{
+  switch (kind) {
+  case IR_LI:
+  case IR_LA:
+  case IR_MOVE:
+  case IR_UNARY:
+  case IR_LOAD:
+    return true;
+  case IR_BINARY:
+    return op != "div" && op != "rem";
+  default:
+    return false;
+  }
+}
+
+bool IRInstr::ends_block() const
+{
+  return kind == IR_BRANCH || kind == IR_BRANCHZ || kind == IR_JUMP || kind == IR_RETURN
+      || kind == IR_SWITCH;
+}
+
+// the comment ending line, with the space before it, or ""
+static std::string comment_of(const std::string &line)
+{
+  size_t hash = line.find('#');
+  if (hash == std::string::npos) return "";
+  while (hash > 0 && (line[hash - 1] == ' ' || line[hash - 1] == '\t')) hash--;
+  return line.substr(hash);
+}
+
+//
+// A rewritten instruction is written out anew.  A call or a jump table
+// jump keeps the comment it had, which names its stack map or its table
+// for place_unit (cgen.cc).
+//
+void IRInstr::lower(ostream &s) const
+{
+  if (!changed) {
+    s << text << endl;
+    return;
+  }
+  switch (kind) {
+  case IR_LI:
+    s << "\tli\t" << dst << " " << imm << endl;
+    break;
+  case IR_LA:
+    s << "\tla\t" << dst << " " << target << endl;
+    break;
+  case IR_MOVE:
+  case IR_UNARY:
+    s << "\t" << op << "\t" << dst << " " << src1 << endl;
+    break;
+  case IR_BINARY:
+    s << "\t" << op << "\t" << dst << " " << src1 << " ";
+    if (src2_imm) s << imm; else s << src2;
+    s << endl;
+    break;
+  case IR_LOAD:
+    s << "\tlw\t" << dst << " " << imm << "(" << src1 << ")" << endl;
+    break;
+  case IR_STORE:
+    s << "\tsw\t" << src1 << " " << imm << "(" << src2 << ")" << endl;
+    break;
+  case IR_BRANCH:
+    s << "\t" << op << "\t" << src1 << " ";
+    if (src2_imm) s << imm; else s << src2;
+    s << " " << target << endl;
+    break;
+  case IR_BRANCHZ:
+    s << "\t" << op << "\t" << src1 << " " << target << endl;
+    break;
+  case IR_JUMP:
+    s << "\tb\t" << target << endl;
+    break;
+  case IR_CALL:
+    if (src1.empty()) s << "\tjal\t" << target;
+    else s << "\tjalr\t\t" << src1;
+    s << comment_of(text) << endl;
+    break;
+  case IR_SWITCH:
+    s << "\tjr\t" << src1 << comment_of(text) << endl;
+    break;
+  default:
+    s << text << endl;
+    break;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////
+//
+// IRFunction
+//
+///////////////////////////////////////////////////////////////////////
+
+//
+// A block starts at a label that follows code, so labels in a row head
+// one block, and ends after a branch, jump or return.  The calls and
+// jump table jumps take their stack maps and targets from info in turn.
+//
+IRFunction::IRFunction(const std::string &code, const IRRoutineInfo &info)
+{
+  std::istringstream lines(code);
+  std::string line;
+  size_t calls = 0, switches = 0;
+  bool in_code = false;   // the last block has more than labels
+  blocks_.push_back(IRBlock());
+  while (std::getline(lines, line)) {
+    IRInstr in = IRInstr::parse(line);
+    if (in.kind == IR_LABEL && in_code) {
+      blocks_.push_back(IRBlock());
+      in_code = false;
+    } else if (in.kind == IR_CALL) {
+      assert(calls < info.call_maps.size());
+      in.stack_map = info.call_maps[calls++] >= 0;
+    } else if (in.kind == IR_SWITCH) {
+      assert(switches < info.switch_targets.size());
+      in.targets = info.switch_targets[switches++];
+      assert(!in.targets.empty());
+    }
+    blocks_.back().instrs.push_back(in);
+    if (in.kind != IR_LABEL) {
+      in_code = true;
+    }
+    if (in.ends_block()) {
+      blocks_.push_back(IRBlock());
+      in_code = false;
+    }
+  }
+  assert(calls == info.call_maps.size());
+  assert(switches == info.switch_targets.size());
+  if (blocks_.back().instrs.empty()) {
+    blocks_.pop_back();
+  }
+  build_cfg();
+}
+
+int IRFunction::find_label(const std::string &label)
+{
+  auto it = label_blocks_.find(label);
+  return it == label_blocks_.end() ? -1 : it->second;
+}
+
+void IRFunction::build_cfg()
+{
+  int n = blocks_.size();
+  label_blocks_.clear();
+  for (int i = 0; i < n; i++) {
+    blocks_[i].succs.clear();
+    blocks_[i].preds.clear();
+    for (auto &in : blocks_[i].instrs) {
+      if (in.kind != IR_LABEL) break;
+      label_blocks_[in.target] = i;
+    }
+  }
+  for (int i = 0; i < n; i++) {
+    IRBlock &b = blocks_[i];
+    const IRInstr *last = b.instrs.empty() ? nullptr : &b.instrs.back();
+    bool falls_through = true;
+    if (last && (last->kind == IR_JUMP || last->kind == IR_BRANCH || last->kind == IR_BRANCHZ)) {
+      int t = find_label(last->target);
+      if (t >= 0) b.succs.push_back(t);
+      falls_through = last->kind != IR_JUMP;
+    } else if (last && last->kind == IR_SWITCH) {
+      for (auto &label : last->targets) {
+        int t = find_label(label);
+        if (t >= 0 && std::find(b.succs.begin(), b.succs.end(), t) == b.succs.end()) {
+          b.succs.push_back(t);
+        }
+      }
+      falls_through = false;
+    } else if (last && last->kind == IR_RETURN) {
+      falls_through = false;
+    }
+    if (falls_through && i + 1 < n
+        && std::find(b.succs.begin(), b.succs.end(), i + 1) == b.succs.end()) {
+      b.succs.push_back(i + 1);
+    }
+  }
+  for (int i = 0; i < n; i++) {
+    for (int s : blocks_[i].succs) {
+      blocks_[s].preds.push_back(i);
+    }
+  }
+}
+
+void IRFunction::lower(ostream &s)
+{
+  for (auto &b : blocks_) {
+    for (auto &in : b.instrs) {
+      in.lower(s);
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////////////
+//
+// Passes
+//
+///////////////////////////////////////////////////////////////////////
+
+//
+// Evaluate op on constants the way the machine would.  Returns false if
+// the result is not known at compile time, or if the instruction traps
+// (add and sub overflow, division by zero).
+//
+static bool evaluate(const std::string &op, int a, int b, int *result)
+{
+  long long x = a, y = b, r;
+  if (op == "add" || op == "addi" || op == "sub") {
+    r = op == "sub" ? x - y : x + y;
+    if (r < INT_MIN || r > INT_MAX) return false;
+  } else if (op == "addu" || op == "addiu") {
+    r = (int) (unsigned) (x + y);
+  } else if (op == "subu") {
+    r = (int) (unsigned) (x - y);
+  } else if (op == "mul") {
+    r = (int) (unsigned) (x * y);
+  } else if (op == "div" || op == "rem") {
+    if (y == 0 || (x == INT_MIN && y == -1)) return false;
+    r = op == "div" ? x / y : x % y;
+  } else if (op == "and" || op == "andi") {
+    r = op == "andi" ? (x & (y & 0xffff)) : (x & y);
+  } else if (op == "or" || op == "ori") {
+    r = op == "ori" ? (x | (y & 0xffff)) : (x | y);
+  } else if (op == "xor") {
+    r = x ^ y;
+  } else if (op == "slt" || op == "slti") {
+    r = x < y;
+  } else if (op == "sle") {
+    r = x <= y;
+  } else if (op == "sgt") {
+    r = x > y;
+  } else if (op == "sge") {
+    r = x >= y;
+  } else if (op == "seq") {
+    r = x == y;
+  } else if (op == "sne") {
+    r = x != y;
+  } else if (op == "sll" || op == "srl" || op == "sra") {
+    if (y < 0 || y > 31) return false;
+    if (op == "sll") r = (int) ((unsigned) a << y);
+    else if (op == "srl") r = (int) ((unsigned) a >> y);
+    else r = a >> y;
+  } else {
+    return false;
+  }
+  *result = (int) r;
+  return true;
+}
+
+static bool branch_taken(const std::string &op, int a, int b)
+{
+  if (op == "beq" || op == "beqz") return a == b;
+  if (op == "bne" || op == "bnez") return a != b;
+  if (op == "blt" || op == "bltz") return a < b;
+  if (op == "ble" || op == "blez") return a <= b;
+  if (op == "bgt" || op == "bgtz") return a > b;
+  return a >= b;   // bge, bgez
+}
+
+class ConstFoldPass : public IRPass {
+public:
+  const char *name() const { return "fold"; }
+  bool run(IRFunction &f);
+};
+
+bool ConstFoldPass::run(IRFunction &f)
+{
+  bool changed = false;
+  for (auto &b : f.blocks()) {
+    std::map<std::string, int> known;
+    auto value = [&](const std::string &reg, int *v) {
+      if (reg == "$zero") { *v = 0; return true; }
+      auto it = known.find(reg);
+      if (it == known.end()) return false;
+      *v = it->second;
+      return true;
+    };
+    for (auto it = b.instrs.begin(); it != b.instrs.end(); ) {
+      IRInstr &in = *it;
+      int x, y, r;
+      bool erase = false;
+      if (in.kind == IR_MOVE && value(in.src1, &x)) {
+        in.set_li(in.dst, x);
+        changed = true;
+      } else if (in.kind == IR_UNARY && in.op == "neg" && value(in.src1, &x) && x != INT_MIN) {
+        in.set_li(in.dst, -x);
+        changed = true;
+      } else if (in.kind == IR_BINARY && value(in.src1, &x)
+                 && (in.src2_imm ? (y = in.imm, true) : value(in.src2, &y))
+                 && evaluate(in.op, x, y, &r)) {
+        in.set_li(in.dst, r);
+        changed = true;
+      } else if ((in.kind == IR_BRANCH && value(in.src1, &x)
+                  && (in.src2_imm ? (y = in.imm, true) : value(in.src2, &y)))
+                 || (in.kind == IR_BRANCHZ && value(in.src1, &x) && (y = 0, true))) {
+        if (branch_taken(in.op, x, y)) {
+          in.set_jump(in.target);
+        } else {
+          erase = true;
+        }
+        changed = true;
+      }
+      if (erase) {
+        it = b.instrs.erase(it);
+        continue;
+      }
+
+      std::set<std::string> defs;
+      in.defs(defs);
+      for (auto &d : defs) known.erase(d);
+      if (in.kind == IR_LI) known[in.dst] = in.imm;
+      ++it;
+    }
+  }
+  if (changed) f.build_cfg();
+  return changed;
+}
+
+class CopyPropPass : public IRPass {
+public:
+  const char *name() const { return "copy"; }
+  bool run(IRFunction &f);
+};
+
+bool CopyPropPass::run(IRFunction &f)
+{
+  bool changed = false;
+  for (auto &b : f.blocks()) {
+    std::map<std::string, std::string> copy_of;
+    for (auto it = b.instrs.begin(); it != b.instrs.end(); ) {
+      IRInstr &in = *it;
+      if (in.kind != IR_OPAQUE && in.kind != IR_CALL) {
+        for (std::string *use : { &in.src1, &in.src2 }) {
+          auto c = copy_of.find(*use);
+          if (!use->empty() && c != copy_of.end()) {
+            *use = c->second;
+            in.changed = true;
+            changed = true;
+          }
+        }
+      }
+      if (in.kind == IR_MOVE && in.dst == in.src1) {
+        it = b.instrs.erase(it);
+        changed = true;
+        continue;
+      }
+
+      std::set<std::string> defs;
+      in.defs(defs);
+      for (auto c = copy_of.begin(); c != copy_of.end(); ) {
+        if (defs.count(c->first) || defs.count(c->second)) {
+          c = copy_of.erase(c);
+        } else {
+          ++c;
+        }
+      }
+      if (in.kind == IR_MOVE) copy_of[in.dst] = in.src1;
+      ++it;
+    }
+  }
+  return changed;
+}
+
+class DeadCodePass : public IRPass {
+public:
+  const char *name() const { return "dce"; }
+  bool run(IRFunction &f);
+};
+
+bool DeadCodePass::run(IRFunction &f)
+{
+  std::vector<IRBlock> &blocks = f.blocks();
+  int n = blocks.size();
+  std::vector<std::set<std::string>> live_in(n);
+
+  // liveness, iterated to a fixed point
+  bool again = true;
+  while (again) {
+    again = false;
+    for (int i = n - 1; i >= 0; i--) {
+      IRBlock &b = blocks[i];
+      std::set<std::string> live;
+      if (b.succs.empty() && (b.instrs.empty() || b.instrs.back().kind != IR_RETURN)) {
+        all_regs(live);    // leaves the routine some other way
+      }
+      for (int s : b.succs) {
+        live.insert(live_in[s].begin(), live_in[s].end());
+      }
+      b.live_out = live;
+      for (auto in = b.instrs.rbegin(); in != b.instrs.rend(); ++in) {
+        std::set<std::string> defs, uses;
+        in->defs(defs);
+        in->uses(uses);
+        for (auto &d : defs) live.erase(d);
+        live.insert(uses.begin(), uses.end());
+      }
+      if (live != live_in[i]) {
+        live_in[i] = live;
+        again = true;
+      }
+    }
+  }
+
+  bool changed = false;
+  for (auto &b : blocks) {
+    std::set<std::string> live = b.live_out;
+    live.insert(always_live, always_live + NELEMS(always_live));
+    for (int j = b.instrs.size() - 1; j >= 0; j--) {
+      IRInstr &in = b.instrs[j];
+      if (in.is_pure() && !live.count(in.dst)) {
+        b.instrs.erase(b.instrs.begin() + j);
+        changed = true;
+        continue;
+      }
+      std::set<std::string> defs, uses;
+      in.defs(defs);
+      in.uses(uses);
+      for (auto &d : defs) live.erase(d);
+      live.insert(uses.begin(), uses.end());
+      live.insert(always_live, always_live + NELEMS(always_live));
+    }
+  }
+  return changed;
+}
+
+class BranchSimpPass : public IRPass {
+public:
+  const char *name() const { return "branch"; }
+  bool run(IRFunction &f);
+};
+
+bool BranchSimpPass::run(IRFunction &f)
+{
+  std::vector<IRBlock> &blocks = f.blocks();
+  bool changed = false;
+
+  // a block of labels alone falls through: its labels head the next one
+  for (int i = blocks.size() - 2; i >= 0; i--) {
+    std::vector<IRInstr> &instrs = blocks[i].instrs;
+    if (std::all_of(instrs.begin(), instrs.end(),
+                    [](const IRInstr &in) { return in.kind == IR_LABEL; })) {
+      std::vector<IRInstr> &next = blocks[i + 1].instrs;
+      next.insert(next.begin(), instrs.begin(), instrs.end());
+      blocks.erase(blocks.begin() + i);
+      changed = true;
+    }
+  }
+  f.build_cfg();
+
+  // thread jumps to blocks that only jump
+  for (auto &b : blocks) {
+    if (b.instrs.empty()) continue;
+    IRInstr &last = b.instrs.back();
+    if (last.kind != IR_JUMP && last.kind != IR_BRANCH && last.kind != IR_BRANCHZ) continue;
+    for (int hops = 0; hops < 8; hops++) {
+      int t = f.find_label(last.target);
+      if (t < 0) break;
+      const IRInstr *first = nullptr;
+      for (auto &in : blocks[t].instrs) {
+        if (in.kind != IR_LABEL) { first = &in; break; }
+      }
+      if (!first || first->kind != IR_JUMP || first->target == last.target) break;
+      last.target = first->target;
+      last.changed = true;
+      changed = true;
+    }
+  }
+  f.build_cfg();
+
+  // remove blocks that cannot be reached from the entry
+  std::vector<bool> reached(blocks.size(), false);
+  std::vector<int> work = { 0 };
+  reached[0] = true;
+  while (!work.empty()) {
+    int i = work.back();
+    work.pop_back();
+    for (int s : blocks[i].succs) {
+      if (!reached[s]) {
+        reached[s] = true;
+        work.push_back(s);
+      }
+    }
+  }
+  std::vector<IRBlock> kept;
+  for (int i = 0; i < (int) blocks.size(); i++) {
+    if (reached[i]) kept.push_back(blocks[i]);
+    else changed = true;
+  }
+  blocks.swap(kept);
+  f.build_cfg();
+
+  // a branch to the block that follows it does nothing
+  for (int i = 0; i + 1 < (int) blocks.size(); i++) {
+    IRBlock &b = blocks[i];
+    if (b.instrs.empty()) continue;
+    IRInstr &last = b.instrs.back();
+    if ((last.kind == IR_JUMP || last.kind == IR_BRANCH || last.kind == IR_BRANCHZ)
+        && f.find_label(last.target) == i + 1) {
+      b.instrs.pop_back();
+      changed = true;
+    }
+  }
+  f.build_cfg();
+  return changed;
+}
+
+class PeepholePass : public IRPass {
+public:
+  const char *name() const { return "peep"; }
+  bool run(IRFunction &f);
+};
+
+// instructions the peephole pass has removed, from every thread
+static std::atomic<int> peephole_removed_cnt(0);
+
+int peephole_removed()
+{
+  return peephole_removed_cnt;
+}
+
+static bool is_addiu(const IRInstr &in, const std::string &reg)
+{
+  return in.kind == IR_BINARY && in.op == "addiu" && in.src2_imm
+      && in.dst == reg && in.src1 == reg;
+}
+
+static bool same_slot(const IRInstr &load, const IRInstr &store)
+{
+  return load.kind == IR_LOAD && store.kind == IR_STORE
+      && load.src1 == store.src2 && load.imm == store.imm;
+}
+
+//
+// Each rule looks at a window of up to four instructions starting at i
+// and returns how many it removed, or -1 if it does not apply.  After a
+// change the window moves back one, since the result may start a new
+// match with the instruction before it.
+//
+static int peephole_at(std::vector<IRInstr> &instrs, size_t i)
+{
+  IRInstr &a = instrs[i];
+  IRInstr *b = i + 1 < instrs.size() ? &instrs[i + 1] : nullptr;
+
+  // addiu r r 0
+  if (a.kind == IR_BINARY && a.op == "addiu" && a.src2_imm && a.imm == 0 && a.dst == a.src1) {
+    instrs.erase(instrs.begin() + i);
+    return 1;
+  }
+  if (!b) return -1;
+
+  // addiu r r m; addiu r r n  =>  addiu r r m+n
+  if (is_addiu(a, a.dst) && is_addiu(*b, a.dst)
+      && a.imm + b->imm >= -32768 && a.imm + b->imm <= 32767) {
+    a.imm += b->imm;
+    a.changed = true;
+    instrs.erase(instrs.begin() + i + 1);
+    return 1;
+  }
+
+  // a push and a pop:
+  //   sw r 0($sp); addiu $sp $sp -4; lw s 4($sp); addiu $sp $sp 4  =>  move s r
+  if (i + 3 < instrs.size()
+      && a.kind == IR_STORE && a.src2 == "$sp" && a.imm == 0 && a.src1 != "$sp"
+      && is_addiu(*b, "$sp") && b->imm == -4
+      && instrs[i + 2].kind == IR_LOAD && instrs[i + 2].src1 == "$sp" && instrs[i + 2].imm == 4
+      && is_addiu(instrs[i + 3], "$sp") && instrs[i + 3].imm == 4) {
+    std::string to = instrs[i + 2].dst, from = a.src1;
+    instrs.erase(instrs.begin() + i + 1, instrs.begin() + i + 4);
+    if (to == from) {
+      instrs.erase(instrs.begin() + i);
+      return 4;
+    }
+    instrs[i].set_move(to, from);
+    return 3;
+  }
+
+  // sw r off(base); lw s off(base)  =>  sw r off(base); move s r
+  if (same_slot(*b, a)) {
+    if (b->dst == a.src1) {
+      instrs.erase(instrs.begin() + i + 1);
+      return 1;
+    }
+    b->set_move(b->dst, a.src1);
+    return 0;
+  }
+
+  // lw r off(base); sw r off(base)  =>  lw r off(base)
+  if (same_slot(a, *b) && a.dst == b->src1 && a.dst != a.src1) {
+    instrs.erase(instrs.begin() + i + 1);
+    return 1;
+  }
+
+  // move r s; move s r  =>  move r s
+  if (a.kind == IR_MOVE && b->kind == IR_MOVE && a.dst == b->src1 && a.src1 == b->dst) {
+    instrs.erase(instrs.begin() + i + 1);
+    return 1;
+  }
+  return -1;
+}
+
+bool PeepholePass::run(IRFunction &f)
+{
+  bool changed = false;
+  int removed = 0;
+  for (auto &b : f.blocks()) {
+    for (size_t i = 0; i < b.instrs.size(); ) {
+      int n = peephole_at(b.instrs, i);
+      if (n < 0) {
+        i++;
+        continue;
+      }
+      removed += n;
+      changed = true;
+      if (i > 0) i--;
+    }
+  }
+  peephole_removed_cnt += removed;
+  return changed;
+}
+
+///////////////////////////////////////////////////////////////////////
+//
+// IRPassManager
+//
+///////////////////////////////////////////////////////////////////////
+
+IRPassManager::IRPassManager()
+{
+  if (!disable_const_fold) passes_.push_back(new ConstFoldPass());
+  if (!disable_copy_prop) passes_.push_back(new CopyPropPass());
+  if (!disable_dce) passes_.push_back(new DeadCodePass());
+  if (!disable_branch_simp) passes_.push_back(new BranchSimpPass());
+  if (!disable_peephole) passes_.push_back(new PeepholePass());
+}
+
+IRPassManager::~IRPassManager()
+{
+  for (auto p : passes_) delete p;
+}
+
+// one pass can expose more work for another, so go round a few times
+void IRPassManager::run(IRFunction &f)
+{
+  for (int round = 0; round < 4; round++) {
+    bool changed = false;
+    for (auto p : passes_) {
+      if (p->run(f)) changed = true;
+    }
+    if (!changed) break;
+  }
+}
+
+void optimize_routine(const std::string &code, const IRRoutineInfo &info, ostream &s)
+{
+  static IRPassManager passes;
+  IRFunction f(code, info);
+  passes.run(f);
+  f.lower(s);
+}
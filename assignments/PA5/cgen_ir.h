@@ -0,0 +1,123 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  cgen_ir.h
+//
+//  A three-address intermediate form for the code of one routine (a
+//  method or a class's _init), with basic blocks and a control flow
+//  graph, and the optimization passes that run on it under -O.
+//
+//  The code generator codes each routine into a buffer in the usual way;
+//  IRFunction reads the instructions back into IRInstrs (an opcode with a
+//  destination and up to two sources), splits them into blocks and links
+//  the blocks.  What the text does not say, the code generator hands over
+//  with it in an IRRoutineInfo.  IRPassManager runs the enabled passes, and lower() writes
+//  the result out as MIPS again.  Each pass can be turned off with
+//  "-x <pass>" (see handle_flags.cc).
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#ifndef _CGEN_IR_H
+#define _CGEN_IR_H
+
+#include "cool-io.h"
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+
+enum IRKind {
+    IR_OPAQUE,     // not understood: a barrier to every pass
+    IR_LABEL,      // label:
+    IR_LI,         // li    dst imm
+    IR_LA,         // la    dst symbol
+    IR_MOVE,       // move  dst src1
+    IR_UNARY,      // neg   dst src1
+    IR_BINARY,     // add   dst src1 src2     (src2 may be an immediate)
+    IR_LOAD,       // lw    dst off(src1)
+    IR_STORE,      // sw    src1 off(src2)
+    IR_BRANCH,     // beq   src1 src2 target  (src2 may be an immediate)
+    IR_BRANCHZ,    // beqz  src1 target
+    IR_JUMP,       // b     target
+    IR_CALL,       // jal   target   /   jalr src1
+    IR_RETURN,     // jr    $ra
+    IR_SWITCH      // jr    src1     (a jump table: targets)
+};
+
+class IRInstr {
+public:
+    IRKind kind;
+    std::string op;
+    std::string dst;
+    std::string src1;
+    std::string src2;
+    std::string target;   // label or routine name
+    std::vector<std::string> targets;   // the labels an IR_SWITCH may go to
+    int imm;              // li immediate, or a memory offset in bytes
+    bool src2_imm;        // src2 is an immediate, not a register
+    std::string text;     // the line as the code generator wrote it
+    bool changed;         // a pass rewrote the instruction
+    bool stack_map;       // a call the collector may run in
+
+    static IRInstr parse(const std::string &line);
+    void set_li(const std::string &reg, int val);
+    void set_move(const std::string &to, const std::string &from);
+    void set_jump(const std::string &label);
+    void uses(std::set<std::string> &regs) const;
+    void defs(std::set<std::string> &regs) const;
+    bool is_pure() const;         // no effect but writing dst
+    bool ends_block() const;
+    void lower(ostream &s) const;
+};
+
+//
+// The code generator notes these as it codes a routine, in the order
+// the instructions come in its text: the stack map of each call (-1 if
+// it has none), and the labels each jump table jump may go to.
+//
+struct IRRoutineInfo {
+    std::vector<int> call_maps;
+    std::vector<std::vector<std::string>> switch_targets;
+};
+
+class IRBlock {
+public:
+    std::vector<IRInstr> instrs;
+    std::vector<int> succs;
+    std::vector<int> preds;
+    std::set<std::string> live_out;
+};
+
+class IRFunction {
+private:
+    std::vector<IRBlock> blocks_;
+    std::map<std::string, int> label_blocks_;   // set by build_cfg
+public:
+    IRFunction(const std::string &code, const IRRoutineInfo &info);
+    std::vector<IRBlock> &blocks() { return blocks_; }
+    void build_cfg();
+    int find_label(const std::string &label);
+    void lower(ostream &s);
+};
+
+class IRPass {
+public:
+    virtual ~IRPass() {}
+    virtual const char *name() const = 0;
+    virtual bool run(IRFunction &f) = 0;    // true if f changed
+};
+
+class IRPassManager {
+private:
+    std::vector<IRPass *> passes_;
+public:
+    IRPassManager();
+    ~IRPassManager();
+    void run(IRFunction &f);
+};
+
+// code a routine's text through the IR and the passes into s
+void optimize_routine(const std::string &code, const IRRoutineInfo &info, ostream &s);
+// instructions the peephole pass has removed so far
+int peephole_removed();
+
+#endif
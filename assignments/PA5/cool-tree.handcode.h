@@ -20,6 +20,8 @@ void dump_Symbol(ostream& stream, int padding, Symbol b);
 void assert_Symbol(Symbol b);
 Symbol copy_Symbol(Symbol b);
 
+class ast_writer;
+class RegAllocator;
 class Program_class;
 typedef Program_class *Program;
 class Class__class;
@@ -45,72 +47,111 @@ typedef list_node<Case> Cases_class;
 typedef Cases_class *Cases;
 
 #define Program_EXTRAS                          \
+virtual void semant() = 0;			\
 virtual void cgen(ostream&) = 0;		\
-virtual void dump_with_types(ostream&, int) = 0; 
+virtual void dump_with_types(ostream&, int) = 0; \
+virtual void dump_binary(ostream&) = 0;          \
+virtual void dump_binary(ast_writer&) = 0;       \
+tree_arena *arena;   /* arena holding this tree */ \
+Program_class() { arena = node_arena; }  \
+void release() { arena->release(); }
 
 
 
 #define program_EXTRAS                          \
+void semant();     				\
 void cgen(ostream&);     			\
-void dump_with_types(ostream&, int);            
+void fold();     				\
+void dump_with_types(ostream&, int);            \
+void dump_binary(ostream&);                     \
+void dump_binary(ast_writer&);
 
 #define Class__EXTRAS                   \
 virtual Symbol get_name() = 0;  	\
 virtual Symbol get_parent() = 0;    	\
+virtual Symbol get_parent_name() = 0;   \
 virtual Symbol get_filename() = 0;      \
-virtual void dump_with_types(ostream&,int) = 0; 
+virtual Features get_features() = 0;    \
+virtual void flatten_lists() = 0;       \
+virtual void dump_with_types(ostream&,int) = 0; \
+virtual void dump_binary(ast_writer&) = 0;
 
 
 #define class__EXTRAS                                  \
 Symbol get_name()   { return name; }		       \
 Symbol get_parent() { return parent; }     	       \
+Symbol get_parent_name() { return parent; }            \
 Symbol get_filename() { return filename; }             \
 Features get_features() { return features; }		   \
-void dump_with_types(ostream&,int);                    
+void flatten_lists();                                  \
+void dump_with_types(ostream&,int);                    \
+void dump_binary(ast_writer&);
 
 
 #define Feature_EXTRAS                                        \
 virtual bool is_method() = 0;                                 \
+virtual bool is_attr() = 0;                                   \
 virtual Symbol get_name() = 0;								 \
-virtual void dump_with_types(ostream&,int) = 0; 
+virtual void flatten_lists() = 0;                             \
+virtual void dump_with_types(ostream&,int) = 0;               \
+virtual void dump_binary(ast_writer&) = 0;
 
 
 #define Feature_SHARED_EXTRAS                                       \
-void dump_with_types(ostream&,int);    
+void flatten_lists();                                               \
+void dump_with_types(ostream&,int);                                 \
+void dump_binary(ast_writer&);
 
 
 #define method_EXTRAS               \
 bool is_method() { return true; }   \
-Symbol get_name()     { return name; }
+bool is_attr() { return false; }    \
+Symbol get_name()     { return name; } \
+Formals get_formals() { return formals; } \
+Symbol get_return_type() { return return_type; } \
+Expression get_body_expr() { return expr; } \
+Symbol type_check();
 
 #define attr_EXTRAS             \
 bool is_method() { return false;} \
+bool is_attr() { return true; }   \
 Symbol get_name()   { return name;  } \
 Symbol get_type()   { return type_decl;  } \
-Expression get_init()  { return init; }
+Expression get_init()  { return init; } \
+Expression get_init_expr() { return init; } \
+Symbol type_check();
 
 #define Formal_EXTRAS                              \
 virtual Symbol get_name() = 0;					 \
-virtual void dump_with_types(ostream&,int) = 0;
+virtual Symbol get_type() = 0;				   	\
+virtual void dump_with_types(ostream&,int) = 0;    \
+virtual void dump_binary(ast_writer&) = 0;
 
 
 #define formal_EXTRAS                           \
 Symbol get_name() { return name; }			  \
-void dump_with_types(ostream&,int);
+Symbol get_type() { return type_decl; }		 	\
+void dump_with_types(ostream&,int);             \
+void dump_binary(ast_writer&);
 
 
 #define Case_EXTRAS                             \
 virtual Symbol get_type_decl() = 0;             \
 virtual Symbol get_name() = 0;                  \
 virtual Expression get_expr() = 0;			  \
-virtual void dump_with_types(ostream& ,int) = 0;
+virtual void flatten_lists() = 0;               \
+virtual void dump_with_types(ostream& ,int) = 0; \
+virtual void dump_binary(ast_writer&) = 0;
 
 
 #define branch_EXTRAS                                   \
+Symbol type_check();									\
 Symbol get_type_decl() { return type_decl; }            \
 Symbol get_name() { return name; }                      \
 Expression get_expr() { return expr; }				  \
-void dump_with_types(ostream& ,int);
+void flatten_lists();                                   \
+void dump_with_types(ostream& ,int);                    \
+void dump_binary(ast_writer&);
 
 
 #define Expression_EXTRAS                    \
@@ -118,13 +159,45 @@ Symbol type;                                 \
 Symbol get_type() { return type; }           \
 Expression set_type(Symbol s) { type = s; return this; } \
 virtual void code(ostream&) = 0; \
+virtual void code_unboxed(ostream&); \
+virtual void alloc_regs(RegAllocator&) = 0; \
+virtual int size() = 0; \
+virtual void flatten_lists() = 0; \
+virtual Expression fold() = 0; \
 virtual void dump_with_types(ostream&,int) = 0;  \
+virtual void dump_binary(ast_writer&) = 0;       \
 void dump_type(ostream&, int);               \
+virtual Symbol type_check() = 0;							\
 Expression_class() { type = (Symbol) NULL; }
 
 #define Expression_SHARED_EXTRAS           \
+Symbol type_check();					  	\
 void code(ostream&); 			   \
-void dump_with_types(ostream&,int); 
+void alloc_regs(RegAllocator&);            \
+int size();                                \
+void flatten_lists();                      \
+Expression fold();                         \
+void dump_with_types(ostream&,int);        \
+void dump_binary(ast_writer&);
+
+// Under -O these leave the raw value of an Int or Bool in ACC
+// instead of a boxed object (see cgen.cc).
+#define assign_EXTRAS  void code_unboxed(ostream&);
+#define cond_EXTRAS    void code_unboxed(ostream&); void code_cond(ostream&, bool);
+#define block_EXTRAS   void code_unboxed(ostream&);
+#define let_EXTRAS     void code_unboxed(ostream&); void code_let(ostream&, bool);
+#define plus_EXTRAS    void code_unboxed(ostream&);
+#define sub_EXTRAS     void code_unboxed(ostream&);
+#define mul_EXTRAS     void code_unboxed(ostream&);
+#define divide_EXTRAS  void code_unboxed(ostream&);
+#define neg_EXTRAS     void code_unboxed(ostream&);
+#define lt_EXTRAS      void code_unboxed(ostream&);
+#define eq_EXTRAS      void code_unboxed(ostream&);
+#define leq_EXTRAS     void code_unboxed(ostream&);
+#define comp_EXTRAS    void code_unboxed(ostream&);
+#define int_const_EXTRAS  void code_unboxed(ostream&);
+#define bool_const_EXTRAS void code_unboxed(ostream&);
+#define object_EXTRAS  void code_unboxed(ostream&);
 
 
 #endif
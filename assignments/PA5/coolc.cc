@@ -0,0 +1,98 @@
+//
+// See copyright.h for copyright notice and limitation of liability
+// and disclaimer of warranty provisions.
+//
+#include "copyright.h"
+
+//////////////////////////////////////////////////////////////////////////////
+//
+//  coolc.cc
+//
+//  Runs every phase of the compiler in one process.  Each input file is
+//  lexed and parsed in turn, the classes of all of the files are checked
+//  by semant, and cgen writes the assembly code.  The phases share one
+//  Program and one set of string tables, instead of printing the tree
+//  and reading it back between processes as mycoolc does.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <unistd.h>
+#include <string.h>
+#include "cool-io.h"  //includes iostream
+#include "cool-tree.h"
+#include "cgen_gc.h"
+
+extern int optind;            // for option processing
+extern char *out_filename;    // name of output assembly
+extern Program ast_root;      // root of the abstract syntax tree
+extern Classes parse_results; // classes of the last file parsed
+extern int omerrs;            // a count of lex and parse errors
+extern int curr_lineno;       // line number of the current token
+extern int node_lineno;       // line number given to new tree nodes
+extern int ast_stats;         // report AST arena usage
+
+FILE *fin;                    // the lexer reads from this file
+char *curr_filename = "<stdin>";
+
+extern int cool_yyparse();
+extern void yyrestart(FILE *);        // point the lexer at a new file
+extern void renumber_string_tables(Program);
+void handle_flags(int argc, char *argv[]);
+
+int main(int argc, char *argv[]) {
+  handle_flags(argc,argv);
+
+  Classes classes = nil_Classes();
+  for (int i = optind; i < argc; i++) {
+      fin = fopen(argv[i], "r");
+      if (fin == NULL) {
+	  cerr << "Could not open input file " << argv[i] << endl;
+	  exit(1);
+      }
+      curr_filename = argv[i];
+      curr_lineno = 1;
+      yyrestart(fin);
+      if (cool_yyparse() == 0)
+	  classes = append_Classes(classes, parse_results);
+      fclose(fin);
+  }
+  if (omerrs != 0) {
+      cerr << "Compilation halted due to lex and parse errors\n";
+      exit(1);
+  }
+  node_lineno = 1;
+  ast_root = program(classes);
+
+  ast_root->semant();
+
+  //
+  // semant has added entries of its own to the string tables, and the
+  // parser added them in source order.  Put the tables in the order cgen
+  // would have read them from semant, so that the code is the same as
+  // mycoolc's.
+  //
+  renumber_string_tables(ast_root);
+
+  if (!out_filename && optind < argc) {   // no -o option
+      char *name = strdup(argv[optind]);
+      char *dot = strrchr(name, '.');
+      if (dot) *dot = '\0'; // strip off file extension
+      out_filename = new char[strlen(name)+8];
+      strcpy(out_filename, name);
+      strcat(out_filename, ".s");
+  }
+
+  if (out_filename) {
+      ofstream s(out_filename);
+      if (!s) {
+	  cerr << "Cannot open output file " << out_filename << endl;
+	  exit(1);
+      }
+      ast_root->cgen(s);
+  } else {
+      ast_root->cgen(cout);
+  }
+  if (ast_stats) ast_root->arena->dump_stats(cerr);
+  ast_root->release();
+}
@@ -25,6 +25,8 @@
 #define BOOLTAG              "_bool_tag"
 #define STRINGTAG            "_string_tag"
 #define HEAP_START           "heap_start"
+#define STACKMAPTAB          "stackMapTab"
+#define STACKMAPS            "_MemMgr_STACKMAPS"
 
 // Naming conventions
 #define DISPTAB_SUFFIX       "_dispTab"
@@ -35,6 +37,10 @@
 #define INTCONST_PREFIX      "int_const"
 #define STRCONST_PREFIX      "str_const"
 #define BOOLCONST_PREFIX     "bool_const"
+#define INTCACHE             "int_cache"
+#define STACKMAP_PREFIX      "stackmap"
+#define CALLSITE_PREFIX      "callsite"
+#define CASETAB_PREFIX       "casetab"
 
 
 #define EMPTYSLOT            0
@@ -68,9 +74,17 @@
 #define ACC  "$a0"		// Accumulator 
 #define A1   "$a1"		// For arguments to prim funcs 
 #define SELF "$s0"		// Ptr to self (callee saves) 
+#define S1   "$s1"		// $s1-$s6 hold allocated locals and
+#define S2   "$s2"		// temporaries (callee saves)
+#define S3   "$s3"
+#define S4   "$s4"
+#define S5   "$s5"
+#define S6   "$s6"
 #define T1   "$t1"		// Temporary 1 
 #define T2   "$t2"		// Temporary 2 
 #define T3   "$t3"		// Temporary 3 
+#define GP   "$gp"		// Heap allocation pointer
+#define LIMIT "$s7"		// Limit of the heap work area
 #define SP   "$sp"		// Stack pointer 
 #define FP   "$fp"		// Frame pointer 
 #define RA   "$ra"		// Return address 
@@ -97,6 +111,9 @@
 #define MUL   "\tmul\t"
 #define SUB   "\tsub\t"
 #define SLL   "\tsll\t"
+#define SLT   "\tslt\t"
+#define SLE   "\tsle\t"
+#define SEQ   "\tseq\t"
 #define BEQZ  "\tbeqz\t"
 #define BRANCH   "\tb\t"
 #define BEQ      "\tbeq\t"
@@ -104,5 +121,6 @@
 #define BLEQ     "\tble\t"
 #define BLT      "\tblt\t"
 #define BGT      "\tbgt\t"
+#define BGE      "\tbge\t"
 
 
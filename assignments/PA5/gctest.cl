@@ -0,0 +1,60 @@
+(*  Runs the generational collector (-g) through minor and major
+    collections while calls have their arguments on the stack, so that
+    the roots the stack maps give it are scanned.  Prints 5010000.
+ *)
+
+class Node {
+   v : Int;
+   next : Node;
+
+   init(x : Int, n : Node) : Node {
+      {
+         v <- x;
+         next <- n;
+         self;
+      }
+   };
+
+   v() : Int { v };
+
+   next() : Node { next };
+};
+
+class Main inherits IO {
+
+   -- conses n nodes onto l, one per nested call
+   build(n : Int, l : Node) : Node {
+      if n = 0 then l
+      else build(n - 1, (new Node).init(n, l))
+      fi
+   };
+
+   sum(l : Node) : Int {
+      (let s : Int <- 0 in
+         {
+            while not isvoid l loop
+               {
+                  s <- s + l.v();
+                  l <- l.next();
+               }
+            pool;
+            s;
+         }
+      )
+   };
+
+   main() : Object {
+      (let l : Node, i : Int <- 0 in
+         {
+            while i < 40 loop
+               {
+                  l <- build(500, l);
+                  i <- i + 1;
+               }
+            pool;
+            out_int(sum(l));
+            out_string("\n");
+         }
+      )
+   };
+};
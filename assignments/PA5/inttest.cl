@@ -0,0 +1,32 @@
+(*  Boxes Int results on both sides of each end of the Int cache
+    (-128..1023 by default, -k under -O), so that values taken from the
+    cache and values allocated are both printed.  Prints
+    -130 -129 -128 -127 -126 1021 1022 1023 1024 1025 and the sum 4475.
+ *)
+
+class Main inherits IO {
+
+   -- n consecutive values from lo, computed at runtime and printed
+   print_from(lo : Int, n : Int) : Int {
+      (let i : Int <- 0, sum : Int <- 0 in
+         {
+            while i < n loop
+               {
+                  out_int(lo + i);
+                  out_string(" ");
+                  sum <- sum + (lo + i);
+                  i <- i + 1;
+               }
+            pool;
+            sum;
+         }
+      )
+   };
+
+   main() : Object {
+      {
+         out_int(print_from(0 - 130, 5) + print_from(1021, 5));
+         out_string("\n");
+      }
+   };
+};
@@ -31,6 +31,8 @@ protected:
   char *str;     // the string
   int  len;      // the length of the string (without trailing \0)
   int index;     // a unique index for each string
+
+  template <class Elem> friend class StringTable;   // for renumber
 public:
   Entry(char *s, int l, int i);
 
@@ -95,8 +97,19 @@ class StringTable
 protected:
    List<Elem> *tbl;   // a string table is a list
    int index;         // the current index
+   Elem **entries;    // entries by index, for lookup(int)
+   int capacity;      // allocated size of entries
+   Elem **buckets;    // open-addressing hash index on (string, length)
+   int nbuckets;      // allocated size of buckets (a power of two)
+
+   static unsigned hash_string(char *s, int len);
+   Elem **find_slot(char *s, int len);   // bucket holding s, or the empty
+                                         // bucket where s would go
+   void grow();                          // double entries and buckets
 public:
-   StringTable(): tbl((List<Elem> *) NULL), index(0) { }   // an empty table
+   StringTable(): tbl((List<Elem> *) NULL), index(0),
+                  entries((Elem **) NULL), capacity(0),
+                  buckets((Elem **) NULL), nbuckets(0) { }   // an empty table
    // The following methods each add a string to the string table.  
    // Only one copy of each string is maintained.  
    // Returns a pointer to the string table entry with the string.
@@ -119,6 +132,9 @@ public:
    Elem *lookup(int index);      // lookup an element using its index
    Elem *lookup_string(char *s); // lookup an element using its string
 
+   // make the table hold just the n entries in order, renumbered from 0
+   void renumber(Elem **order, int n);
+
    void print();  // print the entire table; for debugging
 
 };
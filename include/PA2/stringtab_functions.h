@@ -13,7 +13,10 @@
 
 //
 // A string table is implemented a linked list of Entrys.  Each Entry
-// in the list has a unique string.
+// in the list has a unique string.  The list fixes the order in which
+// code_string_table emits the entries; lookups go through an
+// open-addressing hash index keyed on the (bytes, length) of each string
+// and a dense array mapping indices to entries.
 //
 
 template <class Elem>
@@ -23,38 +26,89 @@ Elem *StringTable<Elem>::add_string(char *s)
 }
 
 //
-// Add a string requires two steps.  First, the list is searched; if the
+// FNV-1a over the first len bytes of s.
+//
+template <class Elem>
+unsigned StringTable<Elem>::hash_string(char *s, int len)
+{
+  unsigned h = 2166136261u;
+  for (int i = 0; i < len; i++) {
+    h ^= (unsigned char) s[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+//
+// Linear probing; the table is kept at most half full, so there is
+// always an empty bucket to stop the search.
+//
+template <class Elem>
+Elem **StringTable<Elem>::find_slot(char *s, int len)
+{
+  unsigned mask = nbuckets - 1;
+  unsigned i = hash_string(s,len) & mask;
+  while (buckets[i] && !buckets[i]->equal_string(s,len))
+    i = (i + 1) & mask;
+  return &buckets[i];
+}
+
+template <class Elem>
+void StringTable<Elem>::grow()
+{
+  int newcap = capacity ? 2 * capacity : 64;
+  Elem **newentries = new Elem *[newcap];
+  for (int i = 0; i < index; i++)
+    newentries[i] = entries[i];
+  delete [] entries;
+  entries = newentries;
+  capacity = newcap;
+
+  delete [] buckets;
+  nbuckets = 2 * capacity;
+  buckets = new Elem *[nbuckets];
+  for (int i = 0; i < nbuckets; i++)
+    buckets[i] = NULL;
+  for (int i = 0; i < index; i++)
+    *find_slot(entries[i]->get_string(), entries[i]->get_len()) = entries[i];
+}
+
+//
+// Add a string requires two steps.  First, the index is searched; if the
 // string is found, a pointer to the existing Entry for that string is 
 // returned.  If the string is not found, a new Entry is created and added
-// to the list.
+// to the list, the index, and the hash table.
 //
 template <class Elem>
 Elem *StringTable<Elem>::add_string(char *s, int maxchars)
 {
   int len = min((int) strlen(s),maxchars);
-  for(List<Elem> *l = tbl; l; l = l->tl())
-    if (l->hd()->equal_string(s,len))
-      return l->hd();
+  if (index == capacity)
+    grow();
+  Elem **slot = find_slot(s,len);
+  if (*slot)
+    return *slot;
 
-  Elem *e = new Elem(s,len,index++);
+  Elem *e = new Elem(s,len,index);
+  *slot = e;
+  entries[index++] = e;
   tbl = new List<Elem>(e, tbl);
   return e;
 }
 
 //
-// To look up a string, the list is scanned until a matching Entry is located.
-// If no such entry is found, an assertion failure occurs.  Thus, this function
-// is used only for strings that one expects to find in the table.
+// To look up a string, its hash bucket is probed until a matching Entry
+// is located.  If no such entry is found, an assertion failure occurs.
+// Thus, this function is used only for strings that one expects to find
+// in the table.
 //
 template <class Elem>
 Elem *StringTable<Elem>::lookup_string(char *s)
 {
-  int len = strlen(s);
-  for(List<Elem> *l = tbl; l; l = l->tl())
-    if (l->hd()->equal_string(s,len))
-      return l->hd();
-  assert(0);   // fail if string is not found
-  return NULL; // to avoid compiler warning
+  assert(nbuckets > 0);   // fail if the table is empty
+  Elem *e = *find_slot(s,strlen(s));
+  assert(e);   // fail if string is not found
+  return e;
 }
 
 //
@@ -64,11 +118,31 @@ Elem *StringTable<Elem>::lookup_string(char *s)
 template <class Elem>
 Elem *StringTable<Elem>::lookup(int ind)
 {
-  for(List<Elem> *l = tbl; l; l = l->tl())
-    if (l->hd()->equal_index(ind))
-      return l->hd();
-  assert(0);   // fail if string is not found
-  return NULL; // to avoid compiler warning
+  assert(0 <= ind && ind < index);   // fail if string is not found
+  return entries[ind];
+}
+
+//
+// renumber empties the table and adds back the n entries of order, so
+// that order[i] gets index i.  Entries that are left out are dropped
+// from the table but not deleted, since they may still be referenced.
+//
+template <class Elem>
+void StringTable<Elem>::renumber(Elem **order, int n)
+{
+  tbl = (List<Elem> *) NULL;
+  index = 0;
+  for (int i = 0; i < nbuckets; i++)
+    buckets[i] = NULL;
+  for (int i = 0; i < n; i++) {
+    Elem *e = order[i];
+    if (index == capacity)
+      grow();
+    e->index = index;
+    *find_slot(e->get_string(), e->get_len()) = e;
+    entries[index++] = e;
+    tbl = new List<Elem>(e, tbl);
+  }
 }
 
 //
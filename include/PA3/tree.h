@@ -15,9 +15,58 @@
 ///////////////////////////////////////////////////////////////////////////
  
 
+#include <stddef.h>
 #include "stringtab.h"
 #include "cool-io.h"
 
+/////////////////////////////////////////////////////////////////////
+//
+//  tree_arena
+//
+//   Tree nodes and list cells are never freed one at a time.  They are
+//   bump-allocated in large blocks from the arena "node_arena" points
+//   to, and the whole arena is freed at once when a phase is done with
+//   the tree.  The interface is:
+//
+//       void *allocate(size_t size, int is_list)
+//         returns size bytes of suitably aligned storage; is_list says
+//         whether the storage is for a list cell (only used for stats).
+//
+//       void *allocate_array(size_t size)
+//         returns size bytes of storage that is not a node (e.g. the
+//         flattened element array of a list).
+//
+//       void release()
+//         frees every block; the arena may be used again afterwards.
+//
+//       void dump_stats(ostream& s)
+//         prints the number of nodes and bytes allocated so far.
+//
+/////////////////////////////////////////////////////////////////////
+class tree_arena {
+private:
+    struct block {
+	block *next;            // previously filled block
+    };
+    block *blocks;              // blocks, most recent first
+    char *next;                 // first free byte in the current block
+    char *limit;                // end of the current block
+    size_t used;                // bytes handed out
+    size_t reserved;            // bytes obtained from malloc
+    int nodes;                  // tree nodes allocated, including list cells
+    int list_cells;             // list cells allocated
+    void new_block(size_t size);
+public:
+    tree_arena();
+    ~tree_arena()  { release(); }
+    void *allocate(size_t size, int is_list);
+    void *allocate_array(size_t size);
+    void release();
+    void dump_stats(ostream& stream);
+};
+
+extern tree_arena *node_arena;
+
 /////////////////////////////////////////////////////////////////////
 //
 //  tree_node
@@ -53,6 +102,8 @@ class tree_node {
 protected:
     int line_number;            // stash the line number when node is made
 public:
+    static void *operator new(size_t size) { return node_arena->allocate(size, 0); }
+    static void operator delete(void *) { }  // freed with the arena
     tree_node();
     virtual tree_node *copy() = 0;
     virtual ~tree_node() { }
@@ -93,11 +144,25 @@ public:
 //     int len()
 //     returns the length of the list
 //
+//     Elem *begin();
+//     Elem *end();
+//       The elements as a contiguous array, for range-based for loops:
+//
+//     for (Elem e : *l)
+//         ... operate on e ...
+//
+//     A list is a tree of append_nodes, but the first call to nth, len,
+//     more, begin or end flattens it into an array cached in the list,
+//     so each of these is constant time from then on.  Lists are never
+//     modified after they are built, so the cache never goes stale.
+//
 //     nth_length(int n, int &len);
 //     Returns the nth element of the list or NULL if there are not n elements.
 //     "len" is set to the length of the list.  This method is used internally
 //     by the APS package to efficiently traverse the list representation.  
 //
+//     List cells are allocated from node_arena like every other tree node.
+//
 //     static list_node<Elem> *nil();
 //     static list_node<Elem> *single(Elem);
 //     static list_node<Elem> *append(list_node<Elem> *, list_node<Elem> *);
@@ -113,7 +178,14 @@ public:
 //////////////////////////////////////////////////////////////////////////////
 
 template <class Elem> class list_node : public tree_node {
+private:
+    Elem *elems;     // the elements in order, once flattened
+    int nelems;      // number of elements; -1 until flattened
+    void flatten();
 public:
+    static void *operator new(size_t size) { return node_arena->allocate(size, 1); }
+    static void operator delete(void *) { }  // freed with the arena
+    list_node() : elems(NULL), nelems(-1) { }
     tree_node *copy()            { return copy_list(); }
     Elem nth(int n);
     //
@@ -123,11 +195,19 @@ public:
     int next(int n)  { return n + 1; }
     int more(int n)  { return (n < len()); }
 
+    Elem *begin()    { if (nelems < 0) flatten(); return elems; }
+    Elem *end()      { if (nelems < 0) flatten(); return elems + nelems; }
+
     virtual list_node<Elem> *copy_list() = 0;
     virtual ~list_node() { }
-    virtual int len() = 0;
+    int len()        { if (nelems < 0) flatten(); return nelems; }
     virtual Elem nth_length(int n, int &len) = 0;
 
+    // used internally by flatten; they walk the tree of cells without
+    // flattening the sublists
+    virtual int count() = 0;
+    virtual Elem *fill(Elem *out) = 0;
+
     static list_node<Elem> *nil();
     static list_node<Elem> *single(Elem);
     static list_node<Elem> *append(list_node<Elem> *l1,list_node<Elem> *l2);
@@ -140,8 +220,9 @@ extern int info_size;
 template <class Elem> class nil_node : public list_node<Elem> {
 public:
     list_node<Elem> *copy_list();
-    int len();
     Elem nth_length(int n, int &len);
+    int count();
+    Elem *fill(Elem *out);
     void dump(ostream& stream, int n);
 };
 
@@ -152,8 +233,9 @@ public:
 	elem = t;
     }
     list_node<Elem> *copy_list();
-    int len();
     Elem nth_length(int n, int &len);
+    int count();
+    Elem *fill(Elem *out);
     void dump(ostream& stream, int n);
 };
 
@@ -167,9 +249,9 @@ public:
 	rest = l2;
     }
     list_node<Elem> *copy_list();
-    int len();
-    Elem nth(int n);
     Elem nth_length(int n, int &len);
+    int count();
+    Elem *fill(Elem *out);
     void dump(ostream& stream, int n);
 };
 
@@ -196,29 +278,28 @@ template <class Elem> list_node<Elem> *list_node<Elem>::append(list_node<Elem> *
 
 template <class Elem> Elem list_node<Elem>::nth(int n)
 {
-    int len;
-    Elem tmp = nth_length(n ,len);
-
-    if (tmp)
-	return tmp;
+    if (n >= 0 && n < len())
+	return elems[n];
     else {
 	cerr << "error: outside the range of the list\n";
 	exit(1);
     }
 }
 
-// added 10/30/06 cgs
-template <class Elem> Elem append_node<Elem>::nth(int n)
-{
-    int len;
-    Elem tmp = nth_length(n ,len);
 
-    if (tmp)
-	return tmp;
-    else {
-	cerr << "error: outside the range of the list\n";
-	exit(1);
-    }
+///////////////////////////////////////////////////////////////////////////
+//
+// list_node::flatten
+//
+// copy the elements into an array owned by the arena, in order
+//
+///////////////////////////////////////////////////////////////////////////
+template <class Elem> void list_node<Elem>::flatten()
+{
+    int n = count();
+    elems = (Elem *) node_arena->allocate_array(n * sizeof(Elem));
+    fill(elems);
+    nelems = n;
 }
 
 ///////////////////////////////////////////////////////////////////////////
@@ -236,16 +317,20 @@ template <class Elem> list_node<Elem> *nil_node<Elem>::copy_list()
 
 ///////////////////////////////////////////////////////////////////////////
 //
-// nil_node::len
-//
-// return the length of the nil_node
+// nil_node::count
+// nil_node::fill
 //
 ///////////////////////////////////////////////////////////////////////////
-template <class Elem> int nil_node<Elem>::len()
+template <class Elem> int nil_node<Elem>::count()
 {
     return 0;
 }
 
+template <class Elem> Elem *nil_node<Elem>::fill(Elem *out)
+{
+    return out;
+}
+
 
 
 ///////////////////////////////////////////////////////////////////////////
@@ -290,16 +375,21 @@ template <class Elem> list_node<Elem> *single_list_node<Elem>::copy_list()
 
 ///////////////////////////////////////////////////////////////////////////
 //
-// single_list_node::len
-//
-// return the length of the single_list_node
+// single_list_node::count
+// single_list_node::fill
 //
 ///////////////////////////////////////////////////////////////////////////
-template <class Elem> int single_list_node<Elem>::len()
+template <class Elem> int single_list_node<Elem>::count()
 {
     return 1;
 }
 
+template <class Elem> Elem *single_list_node<Elem>::fill(Elem *out)
+{
+    *out = elem;
+    return out + 1;
+}
+
 
 ///////////////////////////////////////////////////////////////////////////
 //
@@ -346,14 +436,20 @@ template <class Elem> list_node<Elem> *append_node<Elem>::copy_list()
 
 ///////////////////////////////////////////////////////////////////////////
 //
-// append_node::len
+// append_node::count
+// append_node::fill
 //
-// return the length of the append_node
+// walk both halves; the halves are not flattened themselves
 //
 ///////////////////////////////////////////////////////////////////////////
-template <class Elem> int append_node<Elem>::len()
+template <class Elem> int append_node<Elem>::count()
+{
+    return some->count() + rest->count();
+}
+
+template <class Elem> Elem *append_node<Elem>::fill(Elem *out)
 {
-    return some->len() + rest->len();
+    return rest->fill(some->fill(out));
 }
 
 
@@ -388,10 +484,10 @@ template <class Elem> void append_node<Elem>::dump(ostream& stream, int n)
 {
     int i, size;
 
-    size = len();
+    size = this->len();
     stream << pad(n) << "list\n";
     for (i = 0; i < size; i++)
-      nth(i)->dump(stream, n+2);
+      this->nth(i)->dump(stream, n+2);
     stream << pad(n) << "(end_of_list)\n";
 }
 
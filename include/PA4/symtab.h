@@ -15,57 +15,34 @@
 #define _SYMTAB_H_
 
 #include "list.h"
-
-//
-// SymtabEnty<SYM,DAT> defines the entry for a symbol table that associates
-//    symbols of type `SYM' with data of type `DAT *'.  
-//
-
-template <class SYM, class DAT>
-class SymtabEntry {
-private:
-  SYM id;        // the key field
-  DAT *info;     // associated information for the symbol
-public:
-  SymtabEntry(SYM x, DAT *y) : id(x), info(y) { }
-  SYM get_id() const    { return id; }
-  DAT *get_info() const { return info; }
-};
+#include <unordered_map>
+#include <vector>
 
 //
 // SymbolTable<SYM,DAT> describes a symbol table mapping symbols of
-//    type `SYM' to data of type `DAT *'.  It is implemented as a
-//    list of lists of `SymtabEntry<SYM,DAT> *'.  The inner list is
-//    a scope, a mapping from symbols to data, and the outer list is
-//    a list of scopes. 
-//
-//    `tbl' points to the current top scope.
+//    type `SYM' to data of type `DAT *'.  It is implemented as a hash
+//    map from each symbol to the stack of its bindings, innermost
+//    last, and an undo log of the symbols added, with the point in the
+//    log where each open scope begins.  Symbols are compared with
+//    `==' and hashed with std::hash, so pointer symbols (Symbol,
+//    char *) are compared by identity, as before.
 //
-//    `enterscope' makes the table point to a new scope whose parent
-//       is the scope it pointed to previously.
+//    `enterscope' opens a new scope inside the current one.
 //
-//    `exitscope' makes the table point to the parent scope of the
-//        current scope.  Note that the old child scope is not
-//        deallocated.  One may save the state of a symbol table
-//        at a given point by copying it with `operator ='
+//    `exitscope' closes the current scope, popping the binding of
+//        every symbol added to it since enterscope.  The cost is the
+//        number of symbols the scope added.  One may save the state
+//        of a symbol table at a given point by copying it.
 //
-//    `addid(s,i)' adds a symbol table entry to the current scope of
-//        the symbol table mapping symbol `s' to data `d'.  The old
-//        top scope isn't modified; a new scope is created whose
-//        entry list is the new entry followed by the old entry list,
-//        and whose tail is the old top scope's parent.  The table
-//        is made to point to this new scope.
+//    `addid(s,i)' adds an entry to the current scope mapping symbol
+//        `s' to data `i'.  It shadows any binding of `s' in an outer
+//        scope, and any earlier binding of `s' in the same scope.
 //
-//    `lookup(s)' looks for the symbol `s', starting at the top scope
-//        and proceeding down the list of scopes until either an
-//        entry is found whose `get_id()' equals `s', or the end of
-//        the root scope is reached.  It returns the data item
-//        associated with the entry, or NULL if no such entry exists.
+//    `lookup(s)' returns the data of the innermost binding of `s', or
+//        NULL if there is none.
 //
-//    
-//    `probe(s)' checks the top scope for an entry whose `get_id()'
-//        equals `s', and returns the entry's `get_info()' if
-//        found, and NULL otherwise.
+//    `probe(s)' returns the data of the binding of `s' in the current
+//        scope, and NULL if `s' is not bound there.
 //
 //    `dump()' prints the symbols in the symbol table.
 //
@@ -73,16 +50,17 @@ public:
 template <class SYM, class DAT>
 class SymbolTable
 {
-   typedef SymtabEntry<SYM,DAT> ScopeEntry;
-   typedef List<ScopeEntry> Scope;
-   typedef List<Scope> ScopeList;
 private:
-   ScopeList  *tbl;
+   struct Binding {
+       DAT *info;
+       int depth;           // the scope the binding was added in
+   };
+
+   std::unordered_map<SYM, std::vector<Binding> > bindings;
+   std::vector<SYM> added;           // the undo log
+   std::vector<size_t> scope_start;  // where each open scope begins in it
 public:
-   SymbolTable(): tbl(NULL) { }     // create a new symbol table
-
-   // Create pointer to current symbol table.
-   SymbolTable &operator =(const SymbolTable &s) { tbl = s.tbl; return *this; }
+   SymbolTable() { }     // create a new symbol table
 
    void fatal_error(char * msg)
    {
@@ -90,36 +68,37 @@ public:
      exit(1);
    } 
 
-   // Enter a new scope.  A symbol table is organized as a list of
-   // lists.  The head of the list is the innermost scope, the tail
-   // holds the outer scopes.  A scope must be entered before anything
-   // can be added to the table.
+   // Enter a new scope.  A scope must be entered before anything can
+   // be added to the table.
 
    void enterscope()
    {
-       // The cast of NULL is required for template instantiation to work
-       // correctly.
-       tbl = new ScopeList((Scope *) NULL, tbl);
+       scope_start.push_back(added.size());
    }
 
-   // Pop the first scope off of the symbol table.
+   // Pop the innermost scope off of the symbol table.
    void exitscope()
    {
        // It is an error to exit a scope that doesn't exist.
-       if (tbl == NULL) {
+       if (scope_start.empty()) {
 	   fatal_error("exitscope: Can't remove scope from an empty symbol table.");
        }
-       tbl = tbl->tl();
+       size_t start = scope_start.back();
+       while (added.size() > start) {
+	   bindings[added.back()].pop_back();
+	   added.pop_back();
+       }
+       scope_start.pop_back();
    }
 
    // Add an item to the symbol table.
-   ScopeEntry *addid(SYM s, DAT *i)
+   void addid(SYM s, DAT *i)
    {
        // There must be at least one scope to add a symbol.
-       if (tbl == NULL) fatal_error("addid: Can't add a symbol without a scope.");
-       ScopeEntry * se = new ScopeEntry(s,i);
-       tbl = new ScopeList(new Scope(se, tbl->hd()), tbl->tl());
-       return(se);
+       if (scope_start.empty()) fatal_error("addid: Can't add a symbol without a scope.");
+       Binding b = { i, (int) scope_start.size() };
+       bindings[s].push_back(b);
+       added.push_back(s);
    }
    
    // Lookup an item through all scopes of the symbol table.  If found
@@ -128,38 +107,39 @@ public:
 
    DAT * lookup(SYM s)
    {
-       for(ScopeList *i = tbl; i != NULL; i=i->tl()) {
-	   for( Scope *j = i->hd(); j != NULL; j = j->tl()) {
-	       if (s == j->hd()->get_id()) {
-		   return (j->hd()->get_info());
-	       }
-	   }
+       typename std::unordered_map<SYM, std::vector<Binding> >::const_iterator
+	   i = bindings.find(s);
+       if (i == bindings.end() || i->second.empty()) {
+	   return NULL;
        }
-       return NULL;
+       return i->second.back().info;
    }
 
    // probe the symbol table.  Check the top scope (only) for the item
    // 's'.  If found, return the information field.  If not return NULL.
    DAT *probe(SYM s)
    {
-       if (tbl == NULL) {
+       if (scope_start.empty()) {
 	   fatal_error("probe: No scope in symbol table.");
        }
-       for(Scope *i = tbl->hd(); i != NULL; i = i->tl()) {
-	   if (s == i->hd()->get_id()) {
-	       return(i->hd()->get_info());
-	   }
+       typename std::unordered_map<SYM, std::vector<Binding> >::const_iterator
+	   i = bindings.find(s);
+       if (i == bindings.end() || i->second.empty() ||
+	   i->second.back().depth != (int) scope_start.size()) {
+	   return NULL;
        }
-       return(NULL);
+       return i->second.back().info;
    }
 
    // Prints out the contents of the symbol table  
    void dump()
    {
-      for(ScopeList *i = tbl; i != NULL; i = i->tl()) {
+      size_t scope = scope_start.size();
+      for (size_t i = added.size(); scope > 0; ) {
          cerr << "\nScope: \n";
-         for(Scope *j = i->hd(); j != NULL; j = j->tl()) {
-            cerr << "  " << j->hd()->get_id() << endl;
+         size_t start = scope_start[--scope];
+         while (i > start) {
+            cerr << "  " << added[--i] << endl;
          }
       }
    }
@@ -167,4 +147,3 @@ public:
 };
 
 #endif
-
@@ -6,6 +6,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "cool-io.h"
 #include <unistd.h>
 #include "cgen_gc.h"
@@ -28,8 +29,19 @@ extern int cool_yydebug;        // for the parser
        int semant_debug;        // for semantic analysis
        int cgen_debug;          // for code gen
        bool disable_reg_alloc;  // Don't do register allocation
+       bool disable_const_fold; // -x fold: no constant folding on the IR
+       bool disable_copy_prop;  // -x copy: no copy propagation
+       bool disable_dce;        // -x dce: no dead code elimination
+       bool disable_branch_simp;// -x branch: no branch simplification
+       bool disable_peephole;   // -x peep: no peephole optimization
+       int ast_stats;           // report AST arena usage at the end of a phase
+       int ast_binary;          // pass the AST to the next phase in binary
 
        int cgen_optimize;       // optimize switch for code generator 
+       int cgen_jobs;           // threads coding the classes' routines
+       int cgen_inline_size;    // -i n: inline calls of methods of at most n nodes
+       int cgen_intcache_min;   // -k lo:hi: the Int objects preallocated under -O
+       int cgen_intcache_max;
        char *out_filename;      // file name for generated code
        Memmgr cgen_Memmgr = GC_NOGC;      // enable/disable garbage collection
        Memmgr_Test cgen_Memmgr_Test = GC_NORMAL;  // normal/test GC
@@ -50,10 +62,21 @@ void handle_flags(int argc, char *argv[]) {
   semant_debug = 0;
   cgen_debug = 0;
   cgen_optimize = 0;
+  cgen_jobs = 1;
+  cgen_inline_size = 10;
+  cgen_intcache_min = -128;
+  cgen_intcache_max = 1023;
   disable_reg_alloc = 0;
+  disable_const_fold = 0;
+  disable_copy_prop = 0;
+  disable_dce = 0;
+  disable_branch_simp = 0;
+  disable_peephole = 0;
+  ast_stats = 0;
+  ast_binary = 0;
   
 
-  while ((c = getopt(argc, argv, "lpscvrOo:gtT")) != -1) {
+  while ((c = getopt(argc, argv, "lpscvrOo:gCtTSbx:j:i:k:")) != -1) {
     switch (c) {
 #ifdef DEBUG
     case 'l':
@@ -87,6 +110,9 @@ void handle_flags(int argc, char *argv[]) {
     case 'g':  // enable garbage collection
       cgen_Memmgr = GC_GENGC;
       break;
+    case 'C':  // enable the stop and copy garbage collector instead
+      cgen_Memmgr = GC_SNCGC;
+      break;
     case 't':  // run garbage collection very frequently (on every allocation)
       cgen_Memmgr_Test = GC_TEST;
       break;
@@ -99,6 +125,42 @@ void handle_flags(int argc, char *argv[]) {
     case 'O':  // enable optimization
       cgen_optimize = 1;
       break;
+    case 'S':  // print AST memory statistics
+      ast_stats = 1;
+      break;
+    case 'b':  // write the AST in binary (see ast-binary.cc) instead of text
+      ast_binary = 1;
+      break;
+    case 'j':  // code the routines of the classes on this many threads
+      cgen_jobs = atoi(optarg);
+      if (cgen_jobs < 1)
+        unknownopt = 1;
+      break;
+    case 'i':  // inline calls of methods this small (see code_inline in cgen.cc)
+      cgen_inline_size = atoi(optarg);
+      if (cgen_inline_size < 0)
+        unknownopt = 1;
+      break;
+    case 'k':  // preallocate the Ints from lo to hi (see emit_box_int in cgen.cc)
+      if (sscanf(optarg, "%d:%d", &cgen_intcache_min, &cgen_intcache_max) != 2 ||
+          cgen_intcache_min > cgen_intcache_max ||
+          cgen_intcache_min < -32767 || cgen_intcache_max > 32767)  // an addiu immediate
+        unknownopt = 1;
+      break;
+    case 'x':  // turn off one of the -O passes (see cgen_ir.cc)
+      if (strcmp(optarg, "fold") == 0)
+        disable_const_fold = 1;
+      else if (strcmp(optarg, "copy") == 0)
+        disable_copy_prop = 1;
+      else if (strcmp(optarg, "dce") == 0)
+        disable_dce = 1;
+      else if (strcmp(optarg, "branch") == 0)
+        disable_branch_simp = 1;
+      else if (strcmp(optarg, "peep") == 0)
+        disable_peephole = 1;
+      else
+        unknownopt = 1;
+      break;
     case '?':
       unknownopt = 1;
       break;
@@ -111,9 +173,9 @@ void handle_flags(int argc, char *argv[]) {
   if (unknownopt) {
       cerr << "usage: " << argv[0] << 
 #ifdef DEBUG
-	  " [-lvpscOgtTr -o outname] [input-files]\n";
+	  " [-lvpscOgCtTrSb -x pass -j jobs -i size -k lo:hi -o outname] [input-files]\n";
 #else
-      " [-OgtT -o outname] [input-files]\n";
+      " [-OgCtTSb -x pass -j jobs -i size -k lo:hi -o outname] [input-files]\n";
 #endif
       exit(1);
   }
@@ -29,6 +29,8 @@ extern Program ast_root;	 // the AST produced by the parse
 char *curr_filename = "<stdin>";
 
 extern int omerrs;             // a count of lex and parse errors
+extern int ast_stats;          // report AST arena usage
+extern int ast_binary;         // write the AST in binary
 
 extern int cool_yyparse();
 void handle_flags(int argc, char *argv[]);
@@ -40,7 +42,12 @@ int main(int argc, char *argv[]) {
 	cerr << "Compilation halted due to lex and parse errors\n";
 	exit(1);
     }
-    ast_root->dump_with_types(cout,0);
+    if (ast_binary)
+	ast_root->dump_binary(cout);
+    else
+	ast_root->dump_with_types(cout,0);
+    if (ast_stats) ast_root->arena->dump_stats(cerr);
+    ast_root->release();
     return 0;
 }
 
@@ -4,16 +4,28 @@
 extern Program ast_root;      // root of the abstract syntax tree
 FILE *ast_file = stdin;       // we read the AST from standard input
 extern int ast_yyparse(void); // entry point to the AST parser
+extern int binary_ast(FILE *);          // is the AST in binary?
+extern Program read_binary_ast(FILE *); // entry point to the binary AST reader
 
 int cool_yydebug;     // not used, but needed to link with handle_flags
+extern int ast_stats; // report AST arena usage
+extern int ast_binary; // write the AST in binary
 char *curr_filename;
 
 void handle_flags(int argc, char *argv[]);
 
 int main(int argc, char *argv[]) {
   handle_flags(argc,argv);
-  ast_yyparse();
+  if (binary_ast(ast_file))
+    ast_root = read_binary_ast(ast_file);
+  else
+    ast_yyparse();
   ast_root->semant();
-  ast_root->dump_with_types(cout,0);
+  if (ast_binary)
+    ast_root->dump_binary(cout);
+  else
+    ast_root->dump_with_types(cout,0);
+  if (ast_stats) ast_root->arena->dump_stats(cerr);
+  ast_root->release();
 }
 
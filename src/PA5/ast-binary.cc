@@ -0,0 +1,786 @@
+//
+// See copyright.h for copyright notice and limitation of liability
+// and disclaimer of warranty provisions.
+//
+#include "copyright.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "cool.h"
+#include "tree.h"
+#include "cool-tree.h"
+
+//////////////////////////////////////////////////////////////////
+//
+//  ast-binary.cc
+//
+//  A compact binary encoding of the AST, used to pass the tree from
+//  one phase of the compiler to the next without printing it with
+//  dump_with_types and parsing it again with ast-lex/ast-parse.
+//  The reader recognizes the encoding by its first byte, so a phase
+//  accepts either form on its input.
+//
+//  The encoding is:
+//
+//     magic    the bytes "\177AST" and a version byte
+//
+//     prelude  the identifiers, integer constants and string constants
+//              used by the tree, one table after the other.  A table
+//              is a count followed by that many strings; a string is
+//              a length followed by its characters.
+//
+//     nodes    the program, in the same order dump_with_types visits
+//              it.  Every node starts with a tag byte and its line
+//              number, followed by its components.  A list is a count
+//              followed by its elements.  A symbol is its position
+//              (counting from 1) in the prelude table for its kind,
+//              or 0 for no symbol.  Every Expression ends with its type.
+//
+//  Counts, lengths, line numbers and symbol references are unsigned
+//  LEB128 varints.
+//
+//  Each prelude table lists its strings in the order in which the text
+//  form would first mention them, so a reader that adds them to
+//  idtable, inttable and stringtable in prelude order ends up with the
+//  same tables ast-parse would have built.  The code generator numbers
+//  constants by their position in these tables, so the generated code
+//  does not depend on which form was used.  For the same reason a
+//  bool_const interns "0" or "1" as an integer constant, just as the
+//  text reader does.
+//
+
+static const char ast_magic[] = "\177AST";
+static const int  ast_version = 1;
+
+enum ast_tag {
+  AST_PROGRAM = 1, AST_CLASS, AST_METHOD, AST_ATTR, AST_FORMAL, AST_BRANCH,
+  AST_ASSIGN, AST_STATIC_DISPATCH, AST_DISPATCH, AST_COND, AST_LOOP,
+  AST_TYPCASE, AST_BLOCK, AST_LET, AST_PLUS, AST_SUB, AST_MUL, AST_DIVIDE,
+  AST_NEG, AST_LT, AST_EQ, AST_LEQ, AST_COMP, AST_INT, AST_BOOL, AST_STRING,
+  AST_NEW, AST_ISVOID, AST_NO_EXPR, AST_OBJECT
+};
+
+static void put_number(std::string& out, unsigned n)
+{
+  while (n >= 0x80) {
+    out += (char) ((n & 0x7f) | 0x80);
+    n >>= 7;
+  }
+  out += (char) n;
+}
+
+//////////////////////////////////////////////////////////////////
+//
+//  Writing
+//
+//  ast_writer collects the node stream in memory while it assigns
+//  prelude positions to symbols, since the prelude can only be written
+//  once the whole tree has been seen.  A writer made with tables_only
+//  set just collects the prelude; renumber_string_tables uses one to
+//  put the string tables of an in-memory tree into prelude order.
+//
+//////////////////////////////////////////////////////////////////
+
+class ast_writer {
+private:
+  struct pool {
+    std::map<std::string,int> index;
+    std::vector<std::string> strings;
+
+    int intern(char *s, int len);
+  };
+
+  pool ids, ints, strs;
+  std::string nodes;
+  bool tables_only;
+
+  void put_pool(std::string& out, pool& p);
+  template <class Elem>
+  void renumber(StringTable<Elem>& table, pool& p);
+public:
+  ast_writer(bool tables = false) : tables_only(tables) { }
+  void number(unsigned n)           { if (!tables_only) put_number(nodes, n); }
+  void node(int tag, tree_node *t)  { if (!tables_only) nodes += (char) tag;
+                                      number(t->get_line_number()); }
+  void id(Symbol s)                 { number(s ? ids.intern(s->get_string(), s->get_len()) : 0); }
+  void int_const(Symbol s)          { number(ints.intern(s->get_string(), s->get_len())); }
+  void string_const(Symbol s)       { number(strs.intern(s->get_string(), s->get_len())); }
+  void boolean(Boolean b)           { number(ints.intern(b ? (char *) "1" : (char *) "0", 1)); }
+  void type(Symbol s);
+  void write(ostream& stream);
+  void renumber_tables();
+};
+
+int ast_writer::pool::intern(char *s, int len)
+{
+  std::string key(s, len);
+  std::map<std::string,int>::iterator it = index.find(key);
+  if (it != index.end())
+    return it->second;
+  strings.push_back(key);
+  return index[key] = strings.size();
+}
+
+//
+// The text form prints both a missing type and No_type as "_no_type",
+// which ast-parse reads back as a missing type; do the same here.
+//
+void ast_writer::type(Symbol s)
+{
+  if (s && strcmp(s->get_string(), "_no_type") == 0)
+    s = NULL;
+  id(s);
+}
+
+void ast_writer::put_pool(std::string& out, pool& p)
+{
+  put_number(out, p.strings.size());
+  for (size_t i = 0; i < p.strings.size(); i++) {
+    put_number(out, p.strings[i].size());
+    out += p.strings[i];
+  }
+}
+
+void ast_writer::write(ostream& stream)
+{
+  std::string head(ast_magic);
+  head += (char) ast_version;
+  put_pool(head, ids);
+  put_pool(head, ints);
+  put_pool(head, strs);
+  stream.write(head.data(), head.size());
+  stream.write(nodes.data(), nodes.size());
+  stream.flush();
+}
+
+//
+// Only the integer and string tables are renumbered.  Their order
+// decides how the code generator numbers constants; identifiers are
+// compared by address, so their entries must stay as they are.
+//
+template <class Elem>
+void ast_writer::renumber(StringTable<Elem>& table, pool& p)
+{
+  std::vector<Elem *> order;
+  for (size_t i = 0; i < p.strings.size(); i++)
+    order.push_back(table.add_string((char *) p.strings[i].c_str(),
+                                     p.strings[i].size()));
+  table.renumber(order.empty() ? (Elem **) NULL : &order[0], order.size());
+}
+
+void ast_writer::renumber_tables()
+{
+  renumber(inttable, ints);
+  renumber(stringtable, strs);
+}
+
+void program_class::dump_binary(ostream& stream)
+{
+   ast_writer w;
+   dump_binary(w);
+   w.write(stream);
+}
+
+void program_class::dump_binary(ast_writer& w)
+{
+   w.node(AST_PROGRAM, this);
+   w.number(classes->len());
+   for(int i = classes->first(); classes->more(i); i = classes->next(i))
+     classes->nth(i)->dump_binary(w);
+}
+
+void class__class::dump_binary(ast_writer& w)
+{
+   w.node(AST_CLASS, this);
+   w.id(name);
+   w.id(parent);
+   w.string_const(filename);
+   w.number(features->len());
+   for(int i = features->first(); features->more(i); i = features->next(i))
+     features->nth(i)->dump_binary(w);
+}
+
+void method_class::dump_binary(ast_writer& w)
+{
+   w.node(AST_METHOD, this);
+   w.id(name);
+   w.number(formals->len());
+   for(int i = formals->first(); formals->more(i); i = formals->next(i))
+     formals->nth(i)->dump_binary(w);
+   w.id(return_type);
+   expr->dump_binary(w);
+}
+
+void attr_class::dump_binary(ast_writer& w)
+{
+   w.node(AST_ATTR, this);
+   w.id(name);
+   w.id(type_decl);
+   init->dump_binary(w);
+}
+
+void formal_class::dump_binary(ast_writer& w)
+{
+   w.node(AST_FORMAL, this);
+   w.id(name);
+   w.id(type_decl);
+}
+
+void branch_class::dump_binary(ast_writer& w)
+{
+   w.node(AST_BRANCH, this);
+   w.id(name);
+   w.id(type_decl);
+   expr->dump_binary(w);
+}
+
+void assign_class::dump_binary(ast_writer& w)
+{
+   w.node(AST_ASSIGN, this);
+   w.id(name);
+   expr->dump_binary(w);
+   w.type(type);
+}
+
+void static_dispatch_class::dump_binary(ast_writer& w)
+{
+   w.node(AST_STATIC_DISPATCH, this);
+   expr->dump_binary(w);
+   w.id(type_name);
+   w.id(name);
+   w.number(actual->len());
+   for(int i = actual->first(); actual->more(i); i = actual->next(i))
+     actual->nth(i)->dump_binary(w);
+   w.type(type);
+}
+
+void dispatch_class::dump_binary(ast_writer& w)
+{
+   w.node(AST_DISPATCH, this);
+   expr->dump_binary(w);
+   w.id(name);
+   w.number(actual->len());
+   for(int i = actual->first(); actual->more(i); i = actual->next(i))
+     actual->nth(i)->dump_binary(w);
+   w.type(type);
+}
+
+void cond_class::dump_binary(ast_writer& w)
+{
+   w.node(AST_COND, this);
+   pred->dump_binary(w);
+   then_exp->dump_binary(w);
+   else_exp->dump_binary(w);
+   w.type(type);
+}
+
+void loop_class::dump_binary(ast_writer& w)
+{
+   w.node(AST_LOOP, this);
+   pred->dump_binary(w);
+   body->dump_binary(w);
+   w.type(type);
+}
+
+void typcase_class::dump_binary(ast_writer& w)
+{
+   w.node(AST_TYPCASE, this);
+   expr->dump_binary(w);
+   w.number(cases->len());
+   for(int i = cases->first(); cases->more(i); i = cases->next(i))
+     cases->nth(i)->dump_binary(w);
+   w.type(type);
+}
+
+void block_class::dump_binary(ast_writer& w)
+{
+   w.node(AST_BLOCK, this);
+   w.number(body->len());
+   for(int i = body->first(); body->more(i); i = body->next(i))
+     body->nth(i)->dump_binary(w);
+   w.type(type);
+}
+
+void let_class::dump_binary(ast_writer& w)
+{
+   w.node(AST_LET, this);
+   w.id(identifier);
+   w.id(type_decl);
+   init->dump_binary(w);
+   body->dump_binary(w);
+   w.type(type);
+}
+
+void plus_class::dump_binary(ast_writer& w)
+{
+   w.node(AST_PLUS, this);
+   e1->dump_binary(w);
+   e2->dump_binary(w);
+   w.type(type);
+}
+
+void sub_class::dump_binary(ast_writer& w)
+{
+   w.node(AST_SUB, this);
+   e1->dump_binary(w);
+   e2->dump_binary(w);
+   w.type(type);
+}
+
+void mul_class::dump_binary(ast_writer& w)
+{
+   w.node(AST_MUL, this);
+   e1->dump_binary(w);
+   e2->dump_binary(w);
+   w.type(type);
+}
+
+void divide_class::dump_binary(ast_writer& w)
+{
+   w.node(AST_DIVIDE, this);
+   e1->dump_binary(w);
+   e2->dump_binary(w);
+   w.type(type);
+}
+
+void neg_class::dump_binary(ast_writer& w)
+{
+   w.node(AST_NEG, this);
+   e1->dump_binary(w);
+   w.type(type);
+}
+
+void lt_class::dump_binary(ast_writer& w)
+{
+   w.node(AST_LT, this);
+   e1->dump_binary(w);
+   e2->dump_binary(w);
+   w.type(type);
+}
+
+void eq_class::dump_binary(ast_writer& w)
+{
+   w.node(AST_EQ, this);
+   e1->dump_binary(w);
+   e2->dump_binary(w);
+   w.type(type);
+}
+
+void leq_class::dump_binary(ast_writer& w)
+{
+   w.node(AST_LEQ, this);
+   e1->dump_binary(w);
+   e2->dump_binary(w);
+   w.type(type);
+}
+
+void comp_class::dump_binary(ast_writer& w)
+{
+   w.node(AST_COMP, this);
+   e1->dump_binary(w);
+   w.type(type);
+}
+
+void int_const_class::dump_binary(ast_writer& w)
+{
+   w.node(AST_INT, this);
+   w.int_const(token);
+   w.type(type);
+}
+
+void bool_const_class::dump_binary(ast_writer& w)
+{
+   w.node(AST_BOOL, this);
+   w.boolean(val);
+   w.type(type);
+}
+
+void string_const_class::dump_binary(ast_writer& w)
+{
+   w.node(AST_STRING, this);
+   w.string_const(token);
+   w.type(type);
+}
+
+void new__class::dump_binary(ast_writer& w)
+{
+   w.node(AST_NEW, this);
+   w.id(type_name);
+   w.type(type);
+}
+
+void isvoid_class::dump_binary(ast_writer& w)
+{
+   w.node(AST_ISVOID, this);
+   e1->dump_binary(w);
+   w.type(type);
+}
+
+void no_expr_class::dump_binary(ast_writer& w)
+{
+   w.node(AST_NO_EXPR, this);
+   w.type(type);
+}
+
+void object_class::dump_binary(ast_writer& w)
+{
+   w.node(AST_OBJECT, this);
+   w.id(name);
+   w.type(type);
+}
+
+//////////////////////////////////////////////////////////////////
+//
+//  Reading
+//
+//  ast_reader rebuilds the tree with the same constructors, list
+//  shapes and node_lineno settings that ast-parse uses, so the result
+//  cannot be told apart from a tree read from the text form.
+//
+//////////////////////////////////////////////////////////////////
+
+extern int node_lineno;
+
+class ast_reader {
+private:
+  FILE *in;
+  std::vector<Symbol> ids, ints, strs;
+
+  void error(const char *msg);
+  int byte();
+  unsigned number();
+  template <class Elem>
+  void read_table(StringTable<Elem>& table, std::vector<Symbol>& syms);
+  Symbol symbol(std::vector<Symbol>& syms);
+  Symbol id()               { return symbol(ids); }
+  int node(int tag);
+
+  Class_ read_class();
+  Feature read_feature();
+  Formal read_formal();
+  Case read_branch();
+  Expression read_expression();
+  Expressions read_expressions();
+public:
+  ast_reader(FILE *f) : in(f) { }
+  Program read_program();
+};
+
+void ast_reader::error(const char *msg)
+{
+  cerr << "Error in binary ast: " << msg << endl;
+  exit(1);
+}
+
+int ast_reader::byte()
+{
+  int c = getc(in);
+  if (c == EOF)
+    error("unexpected end of file");
+  return c;
+}
+
+unsigned ast_reader::number()
+{
+  unsigned n = 0;
+  int shift = 0;
+  int c;
+  do {
+    if (shift > 28)
+      error("number too large");
+    c = byte();
+    n |= (unsigned) (c & 0x7f) << shift;
+    shift += 7;
+  } while (c & 0x80);
+  return n;
+}
+
+template <class Elem>
+void ast_reader::read_table(StringTable<Elem>& table, std::vector<Symbol>& syms)
+{
+  std::vector<char> buf;
+  unsigned count = number();
+  for (unsigned i = 0; i < count; i++) {
+    unsigned len = number();
+    buf.resize(len + 1);
+    if (len > 0 && fread(&buf[0], 1, len, in) != len)
+      error("unexpected end of file");
+    buf[len] = '\0';
+    syms.push_back(table.add_string(&buf[0], len));
+  }
+}
+
+Symbol ast_reader::symbol(std::vector<Symbol>& syms)
+{
+  unsigned i = number();
+  if (i > syms.size())
+    error("symbol out of range");
+  return i ? syms[i-1] : (Symbol) NULL;
+}
+
+//
+// node checks the tag of the next node and returns its line number.
+// The caller sets node_lineno only after reading the components, since
+// reading them sets node_lineno for each of the component nodes.
+//
+int ast_reader::node(int tag)
+{
+  if (byte() != tag)
+    error("unexpected node");
+  return number();
+}
+
+Program ast_reader::read_program()
+{
+  for (int i = 0; ast_magic[i]; i++)
+    if (byte() != (unsigned char) ast_magic[i])
+      error("bad magic number");
+  if (byte() != ast_version)
+    error("unsupported version");
+  read_table(idtable, ids);
+  read_table(inttable, ints);
+  read_table(stringtable, strs);
+
+  int line = node(AST_PROGRAM);
+  unsigned n = number();
+  Classes classes = nil_Classes();
+  for (unsigned i = 0; i < n; i++)
+    classes = append_Classes(classes, single_Classes(read_class()));
+  node_lineno = line;
+  return program(classes);
+}
+
+Class_ ast_reader::read_class()
+{
+  int line = node(AST_CLASS);
+  Symbol name = id();
+  Symbol parent = id();
+  Symbol filename = symbol(strs);
+  unsigned n = number();
+  Features features = nil_Features();
+  for (unsigned i = 0; i < n; i++)
+    features = append_Features(features, single_Features(read_feature()));
+  node_lineno = line;
+  return class_(name, parent, features, filename);
+}
+
+Feature ast_reader::read_feature()
+{
+  int tag = byte();
+  if (tag != AST_METHOD && tag != AST_ATTR)
+    error("unexpected node");
+  int line = number();
+  Symbol name = id();
+  if (tag == AST_METHOD) {
+    unsigned n = number();
+    Formals formals = nil_Formals();
+    for (unsigned i = 0; i < n; i++)
+      formals = append_Formals(formals, single_Formals(read_formal()));
+    Symbol return_type = id();
+    Expression expr = read_expression();
+    node_lineno = line;
+    return method(name, formals, return_type, expr);
+  }
+  Symbol type_decl = id();
+  Expression init = read_expression();
+  node_lineno = line;
+  return attr(name, type_decl, init);
+}
+
+Formal ast_reader::read_formal()
+{
+  int line = node(AST_FORMAL);
+  Symbol name = id();
+  Symbol type_decl = id();
+  node_lineno = line;
+  return formal(name, type_decl);
+}
+
+Case ast_reader::read_branch()
+{
+  int line = node(AST_BRANCH);
+  Symbol name = id();
+  Symbol type_decl = id();
+  Expression expr = read_expression();
+  node_lineno = line;
+  return branch(name, type_decl, expr);
+}
+
+Expressions ast_reader::read_expressions()
+{
+  unsigned n = number();
+  Expressions list = nil_Expressions();
+  for (unsigned i = 0; i < n; i++)
+    list = append_Expressions(list, single_Expressions(read_expression()));
+  return list;
+}
+
+Expression ast_reader::read_expression()
+{
+  int tag = byte();
+  int line = number();
+  Symbol s1, s2;
+  Expression e1, e2, e3;
+  Expression result;
+
+  switch (tag) {
+  case AST_ASSIGN:
+    s1 = id();
+    e1 = read_expression();
+    node_lineno = line;
+    result = assign(s1, e1);
+    break;
+  case AST_STATIC_DISPATCH: {
+    e1 = read_expression();
+    s1 = id();
+    s2 = id();
+    Expressions actual = read_expressions();
+    node_lineno = line;
+    result = static_dispatch(e1, s1, s2, actual);
+    break;
+  }
+  case AST_DISPATCH: {
+    e1 = read_expression();
+    s1 = id();
+    Expressions actual = read_expressions();
+    node_lineno = line;
+    result = dispatch(e1, s1, actual);
+    break;
+  }
+  case AST_COND:
+    e1 = read_expression();
+    e2 = read_expression();
+    e3 = read_expression();
+    node_lineno = line;
+    result = cond(e1, e2, e3);
+    break;
+  case AST_LOOP:
+    e1 = read_expression();
+    e2 = read_expression();
+    node_lineno = line;
+    result = loop(e1, e2);
+    break;
+  case AST_TYPCASE: {
+    e1 = read_expression();
+    unsigned n = number();
+    Cases cases = nil_Cases();
+    for (unsigned i = 0; i < n; i++)
+      cases = append_Cases(cases, single_Cases(read_branch()));
+    node_lineno = line;
+    result = typcase(e1, cases);
+    break;
+  }
+  case AST_BLOCK: {
+    Expressions body = read_expressions();
+    node_lineno = line;
+    result = block(body);
+    break;
+  }
+  case AST_LET:
+    s1 = id();
+    s2 = id();
+    e1 = read_expression();
+    e2 = read_expression();
+    node_lineno = line;
+    result = let(s1, s2, e1, e2);
+    break;
+  case AST_PLUS:
+  case AST_SUB:
+  case AST_MUL:
+  case AST_DIVIDE:
+  case AST_LT:
+  case AST_EQ:
+  case AST_LEQ:
+    e1 = read_expression();
+    e2 = read_expression();
+    node_lineno = line;
+    switch (tag) {
+    case AST_PLUS:   result = plus(e1, e2); break;
+    case AST_SUB:    result = sub(e1, e2); break;
+    case AST_MUL:    result = mul(e1, e2); break;
+    case AST_DIVIDE: result = divide(e1, e2); break;
+    case AST_LT:     result = lt(e1, e2); break;
+    case AST_EQ:     result = eq(e1, e2); break;
+    default:         result = leq(e1, e2); break;
+    }
+    break;
+  case AST_NEG:
+  case AST_COMP:
+  case AST_ISVOID:
+    e1 = read_expression();
+    node_lineno = line;
+    switch (tag) {
+    case AST_NEG:    result = neg(e1); break;
+    case AST_COMP:   result = comp(e1); break;
+    default:         result = isvoid(e1); break;
+    }
+    break;
+  case AST_INT:
+    s1 = symbol(ints);
+    node_lineno = line;
+    result = int_const(s1);
+    break;
+  case AST_BOOL:
+    s1 = symbol(ints);
+    node_lineno = line;
+    result = bool_const(s1 && *s1->get_string() == '1');
+    break;
+  case AST_STRING:
+    s1 = symbol(strs);
+    node_lineno = line;
+    result = string_const(s1);
+    break;
+  case AST_NEW:
+    s1 = id();
+    node_lineno = line;
+    result = new_(s1);
+    break;
+  case AST_NO_EXPR:
+    node_lineno = line;
+    result = no_expr();
+    break;
+  case AST_OBJECT:
+    s1 = id();
+    node_lineno = line;
+    result = object(s1);
+    break;
+  default:
+    error("unexpected node");
+    return NULL;
+  }
+  return result->set_type(id());
+}
+
+//
+// binary_ast peeks at the first byte of f to tell the binary encoding
+// from the text form, which always starts with a line number ("#").
+//
+int binary_ast(FILE *f)
+{
+  int c = getc(f);
+  ungetc(c, f);
+  return c == (unsigned char) ast_magic[0];
+}
+
+Program read_binary_ast(FILE *f)
+{
+  ast_reader r(f);
+  return r.read_program();
+}
+
+//
+// renumber_string_tables leaves inttable and stringtable holding just the
+// constants of p, in the order a phase reading p from the previous phase
+// would have added them.  A compiler that keeps the tree in memory calls
+// it between semant and cgen so that its output matches the pipeline's.
+//
+void renumber_string_tables(Program p)
+{
+  ast_writer w(true);
+  p->dump_binary(w);
+  w.renumber_tables();
+}